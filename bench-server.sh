@@ -0,0 +1,33 @@
+#!/bin/sh
+# Request latency of main.c over loopback TCP versus a Unix domain socket,
+# one keep-alive connection each (see http-bench.c).
+#
+# Usage: ./bench-server.sh [requests]
+#
+# Serves the snapshot written by bench.sh, which is run first if there is
+# none. CC and CFLAGS are passed through the environment.
+set -e
+
+REQUESTS=${1:-20000}
+CC=${CC:-cc}
+CFLAGS=${CFLAGS:--O2}
+OUT=_bench
+SOCKET="$OUT/main.sock"
+
+cd "$(dirname "$0")"
+[ -f "$OUT/pipelines.snapshot" ] || ./bench.sh 100 100 0 >/dev/null
+
+$CC $CFLAGS -std=c99 -D_GNU_SOURCE -Ideps/buf main.c -o "$OUT/main" \
+    -luv -lhttp_parser
+$CC $CFLAGS -std=c99 -D_GNU_SOURCE -Ideps/buf http-bench.c \
+    -o "$OUT/http-bench"
+
+"$OUT/main" -u "$SOCKET" "$OUT/pipelines.snapshot" >/dev/null &
+MAIN_PID=$!
+trap 'kill $MAIN_PID 2>/dev/null' EXIT INT TERM
+sleep 0.5
+
+for path in /api/projects/1 /api/projects /; do
+    "$OUT/http-bench" tcp:127.0.0.1:8888 "$path" "$REQUESTS"
+    "$OUT/http-bench" "unix:$SOCKET" "$path" "$REQUESTS"
+done
@@ -0,0 +1,43 @@
+#!/bin/sh
+# End-to-end throughput benchmark: gitlab-api polling a local mock-gitlab.
+#
+# Usage: ./bench.sh [projects] [pipelines_per_project] [latency_ms]
+#
+# Other knobs are passed through the environment: MOCK_PER_PAGE,
+# MOCK_SLOW_EVERY, MOCK_SLOW_MS, MOCK_429_EVERY, MOCK_RATE_LIMIT, MOCK_GZIP
+# (see mock-gitlab.c), GITLAB_API_FLAGS (e.g. -H), CC and CFLAGS.
+# TRACE_FILE=path makes gitlab-api dump a Chrome trace there (see trace.h).
+# Prints projects/s, pipelines parsed/s, peak RSS and allocations per
+# pipeline as reported by gitlab-api, then queries the snapshot it wrote.
+set -e
+
+PROJECTS=${1:-1000}
+PIPELINES=${2:-200}
+LATENCY_MS=${3:-5}
+PORT=${PORT:-8889}
+CC=${CC:-cc}
+CFLAGS=${CFLAGS:--O2}
+OUT=_bench
+
+cd "$(dirname "$0")"
+mkdir -p "$OUT"
+
+$CC $CFLAGS -std=c99 -D_GNU_SOURCE -Ideps/buf mock-gitlab.c \
+    -o "$OUT/mock-gitlab" -luv -lhttp_parser -lz
+$CC $CFLAGS -std=c99 -D_GNU_SOURCE -DWITH_ALLOC_STATS gitlab-api.c \
+    -o "$OUT/gitlab-api" -luv -lcurl \
+    -Wl,--wrap=malloc,--wrap=calloc,--wrap=realloc
+$CC $CFLAGS -std=c99 -D_GNU_SOURCE -Ideps/buf snapshot-query.c \
+    -o "$OUT/snapshot-query"
+
+PORT=$PORT MOCK_PROJECTS=$PROJECTS MOCK_PIPELINES=$PIPELINES \
+    MOCK_LATENCY_MS=$LATENCY_MS MOCK_RATE_LIMIT=${MOCK_RATE_LIMIT:-600000} \
+    "$OUT/mock-gitlab" &
+MOCK_PID=$!
+trap 'kill $MOCK_PID 2>/dev/null' EXIT INT TERM
+sleep 0.5
+
+GITLAB_API_URL="http://127.0.0.1:$PORT/api/v4" \
+    "$OUT/gitlab-api" -q $GITLAB_API_FLAGS -o "$OUT/pipelines.snapshot" \
+    $(seq 1 "$PROJECTS")
+"$OUT/snapshot-query" "$OUT/pipelines.snapshot" latest failed >/dev/null
@@ -2,9 +2,12 @@
 
 #include <assert.h>
 #include <inttypes.h>
+#include <stdarg.h>
 #include <stdbool.h>
+#include <stddef.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
 #define i64 int64_t
 #define u64 uint64_t
@@ -65,29 +68,7 @@ static bool is_tty = false;
         (void)(x); \
     } while (0)
 
-#if WITH_LOGS == 0
-#define log_debug(fmt, ...) \
-    do {                    \
-        IGNORE(fmt);        \
-    } while (0)
-#define log_debug_with_indent(indent, fmt, ...) \
-    do {                                        \
-        IGNORE(indent);                         \
-        IGNORE(fmt);                            \
-    } while (0)
-#else
-#define log_debug(fmt, ...)                                                \
-    do {                                                                   \
-        fprintf(stderr, "[debug] %s:%s:%d: " fmt "\n", __FILE__, __func__, \
-                __LINE__, __VA_ARGS__);                                    \
-    } while (0)
-#define log_debug_with_indent(indent, fmt, ...)                              \
-    do {                                                                     \
-        fprintf(stderr, "[debug] %s:%s:%d: ", __FILE__, __func__, __LINE__); \
-        for (i32 i = 0; i < indent; i++) fprintf(stderr, " ");               \
-        fprintf(stderr, fmt "\n", __VA_ARGS__);                              \
-    } while (0)
-#endif
+// Logging on the hot paths goes through the runtime tracing of trace.h.
 
 typedef enum {
     COL_RESET,
@@ -117,3 +98,48 @@ static const char mkt_colors[2][COL_COUNT][14] = {
     } while (0)
 
 #define ARR_SIZE(arr) (sizeof(arr) / sizeof(arr[0]))
+
+static inline bool str_eq_ignore_case(const char* a, usize a_len,
+                                      const char* b) {
+    if (a_len != strlen(b)) return false;
+    for (usize i = 0; i < a_len; i++) {
+        char x = a[i], y = b[i];
+        if (x >= 'A' && x <= 'Z') x += 'a' - 'A';
+        if (y >= 'A' && y <= 'Z') y += 'a' - 'A';
+        if (x != y) return false;
+    }
+    return true;
+}
+
+static inline u32 fnv1a(const char* s, usize len) {
+    u32 h = 2166136261u;
+    for (usize i = 0; i < len; i++) {
+        h ^= (u8)s[i];
+        h *= 16777619u;
+    }
+    return h;
+}
+
+// Helpers for buf.h arrays of chars, when it is included first.
+#ifdef BUF_INIT_CAPACITY
+__attribute__((format(printf, 2, 3))) static inline void buf_printf(
+    char** b, const char* fmt, ...) {
+    va_list ap;
+    va_start(ap, fmt);
+    const int len = vsnprintf(NULL, 0, fmt, ap);
+    va_end(ap);
+
+    const usize size = buf_size(*b);
+    if (buf_capacity(*b) < size + len + 1)
+        buf_grow(*b, (ptrdiff_t)(size + len + 1 + buf_capacity(*b)));
+
+    va_start(ap, fmt);
+    vsnprintf(*b + size, len + 1, fmt, ap);
+    va_end(ap);
+    buf_ptr(*b)->size += len;
+}
+
+static inline void buf_append(char** b, const char* s, usize len) {
+    for (usize i = 0; i < len; i++) buf_push(*b, s[i]);
+}
+#endif
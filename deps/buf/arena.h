@@ -0,0 +1,184 @@
+/* arena.h --- bump allocator regions for C99, companion to buf.h
+ * This is free and unencumbered software released into the public domain.
+ *
+ *   arena_alloc(a, n)        : allocate N bytes (16 bytes aligned) from A
+ *   arena_strndup(a, s, n)   : copy N bytes of S and a NUL into A
+ *   arena_mark(a)            : return the current position of A
+ *   arena_reset(a, m)        : free everything allocated since the mark M
+ *   arena_free(a)            : free everything, including the chunks
+ *   abuf_push(a, v, e)       : buf_push() with the storage taken from A
+ *   abuf_grow(a, v, n)       : buf_grow() with the storage taken from A
+ *
+ * Memory comes in chunks of ARENA_CHUNK_SIZE bytes (more for larger
+ * allocations) chained together: allocating is a pointer bump and freeing a
+ * whole region, e.g. everything a request allocated, is one call whatever
+ * the number of allocations. arena_reset() keeps the oldest chunk, so an
+ * arena reset after each request does not go back to malloc() either.
+ *
+ * abuf arrays have the buf.h layout: buf_size(), buf_capacity(), buf_pop()
+ * and buf_clear() work on them, but they must never be passed to
+ * buf_push(), buf_grow() or buf_free() since the arena owns them. Growing
+ * the most recent allocation of the arena is done in place.
+ *
+ * Define ARENA_POISON to fill freed memory with 0xdd, so that use after
+ * reset shows up as garbage rather than as plausible stale data.
+ *
+ * buf.h must be included first.
+ *
+ * Example usage:
+ *
+ *     arena_t arena = {0};
+ *     arena_mark_t mark = arena_mark(&arena);
+ *     int *values = 0;
+ *     for (int i = 0; i < 25; i++)
+ *         abuf_push(&arena, values, i);
+ *     char *name = arena_strndup(&arena, "hello", 5);
+ *     arena_reset(&arena, mark); // values and name are gone
+ *     arena_free(&arena);
+ */
+#ifndef ARENA_H
+#define ARENA_H
+
+#ifndef BUF_INIT_CAPACITY
+#error "buf.h must be included before arena.h"
+#endif
+
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifndef ARENA_CHUNK_SIZE
+#define ARENA_CHUNK_SIZE (64 * 1024)
+#endif
+
+#define ARENA_ALIGN 16
+
+struct arena_chunk {
+    struct arena_chunk *prev;
+    size_t size;
+    size_t capacity;
+    size_t pad_; /* Keeps data ARENA_ALIGN aligned */
+    char data[];
+};
+
+typedef struct {
+    struct arena_chunk *chunk; /* Most recent */
+} arena_t;
+
+typedef struct {
+    struct arena_chunk *chunk;
+    size_t size;
+} arena_mark_t;
+
+static inline void arena_poison(void *p, size_t n) {
+#ifdef ARENA_POISON
+    memset(p, 0xdd, n);
+#else
+    (void)p;
+    (void)n;
+#endif
+}
+
+static inline void *arena_alloc(arena_t *a, size_t n) {
+    struct arena_chunk *c = a->chunk;
+    n = (n + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1);
+    if (!c || c->capacity - c->size < n) {
+        size_t capacity = n > ARENA_CHUNK_SIZE ? n : ARENA_CHUNK_SIZE;
+        c = malloc(sizeof(struct arena_chunk) + capacity);
+        if (!c) BUF_ABORT;
+        c->prev = a->chunk;
+        c->size = 0;
+        c->capacity = capacity;
+        a->chunk = c;
+    }
+    c->size += n;
+    return c->data + c->size - n;
+}
+
+static inline char *arena_strndup(arena_t *a, const char *s, size_t n) {
+    char *p = arena_alloc(a, n + 1);
+    memcpy(p, s, n);
+    p[n] = 0;
+    return p;
+}
+
+static inline arena_mark_t arena_mark(const arena_t *a) {
+    arena_mark_t m;
+    m.chunk = a->chunk;
+    m.size = a->chunk ? a->chunk->size : 0;
+    return m;
+}
+
+static inline void arena_reset(arena_t *a, arena_mark_t m) {
+    while (a->chunk != m.chunk) {
+        struct arena_chunk *c = a->chunk;
+        if (!m.chunk && !c->prev) { /* Keep the oldest one around */
+            arena_poison(c->data, c->size);
+            c->size = 0;
+            return;
+        }
+        a->chunk = c->prev;
+        arena_poison(c->data, c->size);
+        free(c);
+    }
+    if (m.chunk) {
+        arena_poison(m.chunk->data + m.size, m.chunk->size - m.size);
+        m.chunk->size = m.size;
+    }
+}
+
+static inline void arena_free(arena_t *a) {
+    while (a->chunk) {
+        struct arena_chunk *c = a->chunk;
+        a->chunk = c->prev;
+        arena_poison(c->data, c->size);
+        free(c);
+    }
+}
+
+#define abuf_push(a, v, e)                                            \
+    do {                                                              \
+        if (buf_capacity((v)) == buf_size((v))) {                     \
+            (v) = abuf_grow1(                                         \
+                (a), v, sizeof(*(v)),                                 \
+                (ptrdiff_t)(!buf_capacity((v)) ? BUF_INIT_CAPACITY    \
+                                               : buf_capacity((v)))); \
+        }                                                             \
+        (v)[buf_ptr((v))->size++] = (e);                              \
+    } while (0)
+
+#define abuf_grow(a, v, n) ((v) = abuf_grow1((a), (v), sizeof(*(v)), n))
+
+static inline void *abuf_grow1(arena_t *a, void *v, size_t esize,
+                               ptrdiff_t n) {
+    struct buf *p = v ? buf_ptr(v) : 0;
+    struct arena_chunk *c = a->chunk;
+    size_t max = (size_t)-1 - sizeof(struct buf);
+    size_t capacity = (p ? p->capacity : 0) + (size_t)n;
+    if (n < 0 || capacity > max / esize) BUF_ABORT; /* overflow */
+
+    size_t old_bytes = p ? sizeof(struct buf) + esize * p->capacity : 0;
+    size_t new_bytes = sizeof(struct buf) + esize * capacity;
+    size_t old_aligned =
+        (old_bytes + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1);
+    /* The last allocation of the chunk: extend it in place */
+    if (p && c && (char *)p + old_aligned == c->data + c->size &&
+        c->capacity - c->size + old_aligned >= new_bytes) {
+        c->size -= old_aligned;
+        arena_alloc(a, new_bytes);
+        p->capacity = capacity;
+        return p->buffer;
+    }
+
+    struct buf *q = arena_alloc(a, new_bytes);
+    q->capacity = capacity;
+    q->size = 0;
+    if (p) {
+        memcpy(q, p, old_bytes);
+        q->capacity = capacity;
+        arena_poison(p, old_bytes);
+    }
+    return q->buffer;
+}
+
+#endif
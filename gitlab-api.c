@@ -1,21 +1,27 @@
 #include <assert.h>
 #include <curl/curl.h>
 #include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdbool.h>
 #include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/resource.h>
+#include <time.h>
 #include <unistd.h>
+#include <uv.h>
 
+#include "common.h"
 #include "deps/buf/buf.h"
+
+#include "deps/buf/arena.h"  // Needs buf.h first
 #include "deps/jsmn/jsmn.h"
 #include "deps/sds/sds.c"
 #include "deps/sds/sds.h"
 #include "deps/sds/sdsalloc.h"
-
-typedef int64_t i64;
-typedef uint64_t u64;
-
-jsmntok_t *json_tokens;
+#include "snapshot.h"
+#include "trace.h"
 
 static int json_eq(const char *json, const jsmntok_t *tok, const char *s,
                    u64 s_len) {
@@ -26,56 +32,371 @@ static int json_eq(const char *json, const jsmntok_t *tok, const char *s,
   return -1;
 }
 
+// Columns of `pipeline_store_t` grow by moving to a bigger block of the
+// arena: the old block is only reclaimed with the whole arena.
+static void *arena_grow_array(arena_t *arena, const void *old, u64 old_len,
+                              u64 new_cap, u64 elem_size) {
+  void *const p = arena_alloc(arena, new_cap * elem_size);
+  if (old_len) memcpy(p, old, old_len * elem_size);
+  return p;
+}
+
+static i64 parse_digits(const char *s, u64 n) {
+  i64 res = 0;
+  for (u64 i = 0; i < n; i++) {
+    if (s[i] < '0' || s[i] > '9') return -1;
+    res = res * 10 + (s[i] - '0');
+  }
+  return res;
+}
+
+// Days since 1970-01-01 for a proleptic Gregorian date (Howard Hinnant's
+// `days_from_civil`), so that we do not depend on `timegm` and the TZ.
+static i64 days_from_civil(i64 y, i64 m, i64 d) {
+  y -= m <= 2;
+  const i64 era = (y >= 0 ? y : y - 399) / 400;
+  const i64 yoe = y - era * 400;
+  const i64 doy = (153 * (m + (m > 2 ? -3 : 9)) + 2) / 5 + d - 1;
+  const i64 doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+  return era * 146097 + doe - 719468;
+}
+
+// Parse an ISO 8601 timestamp as returned by the GitLab API e.g.
+// `2021-03-08T10:20:30.123Z` or `2021-03-08T11:20:30.123+01:00` into seconds
+// since the epoch. Returns 0 when malformed.
+static i64 timestamp_parse(const char *s, u64 len) {
+  if (len < 19 || s[4] != '-' || s[7] != '-' || s[10] != 'T' || s[13] != ':' ||
+      s[16] != ':')
+    return 0;
+
+  const i64 year = parse_digits(s, 4), month = parse_digits(s + 5, 2),
+            day = parse_digits(s + 8, 2), hour = parse_digits(s + 11, 2),
+            minute = parse_digits(s + 14, 2), second = parse_digits(s + 17, 2);
+  if (year < 0 || month < 1 || month > 12 || day < 1 || day > 31 || hour < 0 ||
+      minute < 0 || second < 0)
+    return 0;
+
+  u64 i = 19;
+  if (i < len && s[i] == '.') {
+    i++;
+    while (i < len && s[i] >= '0' && s[i] <= '9') i++;
+  }
+
+  i64 offset = 0;
+  if (i + 6 == len && (s[i] == '+' || s[i] == '-') && s[i + 3] == ':') {
+    const i64 offset_hours = parse_digits(s + i + 1, 2),
+              offset_minutes = parse_digits(s + i + 4, 2);
+    if (offset_hours < 0 || offset_minutes < 0) return 0;
+    offset = (offset_hours * 60 + offset_minutes) * 60;
+    if (s[i] == '-') offset = -offset;
+  } else if (!(i + 1 == len && s[i] == 'Z')) {
+    return 0;
+  }
+
+  return days_from_civil(year, month, day) * 86400 + hour * 3600 +
+         minute * 60 + second - offset;
+}
+
+static u64 xorshift64(u64 *state) {
+  u64 x = *state;
+  x ^= x << 13;
+  x ^= x >> 7;
+  x ^= x << 17;
+  *state = x;
+  return x;
+}
+
+typedef enum {
+  TR_FETCH,
+  TR_RETRY,
+  TR_HEDGE,
+  TR_PARSE,
+  TR_MERGE,
+  TR_SNAPSHOT,
+  TR_COUNT,
+} trace_id_t;
+
+static const trace_desc_t trace_descs[TR_COUNT] = {
+    [TR_FETCH] = {"fetch", {"request", "project_id"}},
+    [TR_RETRY] = {"retry", {"project_id", "http_status"}},
+    [TR_HEDGE] = {"hedge", {"project_id", "page"}},
+    [TR_PARSE] = {"parse", {"project_id", "bytes"}},
+    [TR_MERGE] = {"merge", {"project_id", "pipelines"}},
+    [TR_SNAPSHOT] = {"snapshot", {"projects", "pipelines"}},
+};
+
+// Pipelines of one project, stored column-wise so that scanning e.g. all
+// statuses or all timestamps only touches that column. Every array (and every
+// string) lives in `pst_arena`: `pipeline_store_free` releases a whole poll
+// in one call. Refs are interned since most pipelines run on a handful of
+// branches.
 typedef struct {
-  i64 pip_id;
-  sds pip_vcs_ref, pip_url, pip_created_at, pip_updated_at, pip_status;
-} pipeline_t;
+  arena_t pst_arena;
+  u64 pst_len, pst_cap;
+  i64 *pst_ids, *pst_created_at, *pst_updated_at;
+  u8 *pst_statuses;  // pipeline_status_t
+  u32 *pst_refs;     // Index in `pst_ref_strs`
+  char **pst_urls;
+
+  char **pst_ref_strs;
+  u32 *pst_ref_lens;
+  u32 pst_ref_count, pst_ref_cap;
+  u32 *pst_ref_slots;  // Open addressing, holds ref index + 1, 0 means empty
+  u32 pst_ref_slots_cap;
+} pipeline_store_t;
+
+static void pipeline_store_free(pipeline_store_t *store) {
+  arena_free(&store->pst_arena);
+  *store = (pipeline_store_t){0};
+}
+
+static void pipeline_store_ref_slots_grow(pipeline_store_t *store) {
+  const u32 cap = store->pst_ref_slots_cap ? store->pst_ref_slots_cap * 2 : 16;
+  u32 *const slots = arena_alloc(&store->pst_arena, cap * sizeof(u32));
+  memset(slots, 0, cap * sizeof(u32));
+
+  for (u32 ref = 0; ref < store->pst_ref_count; ref++) {
+    u32 i = fnv1a(store->pst_ref_strs[ref], store->pst_ref_lens[ref]) &
+            (cap - 1);
+    while (slots[i]) i = (i + 1) & (cap - 1);
+    slots[i] = ref + 1;
+  }
+  store->pst_ref_slots = slots;
+  store->pst_ref_slots_cap = cap;
+}
+
+static u32 pipeline_store_intern_ref(pipeline_store_t *store, const char *s,
+                                     u32 len) {
+  if ((store->pst_ref_count + 1) * 2 > store->pst_ref_slots_cap)
+    pipeline_store_ref_slots_grow(store);
+
+  const u32 mask = store->pst_ref_slots_cap - 1;
+  u32 i = fnv1a(s, len) & mask;
+  for (; store->pst_ref_slots[i]; i = (i + 1) & mask) {
+    const u32 ref = store->pst_ref_slots[i] - 1;
+    if (store->pst_ref_lens[ref] == len &&
+        memcmp(store->pst_ref_strs[ref], s, len) == 0)
+      return ref;
+  }
+
+  if (store->pst_ref_count == store->pst_ref_cap) {
+    const u32 cap = store->pst_ref_cap ? store->pst_ref_cap * 2 : 8;
+    store->pst_ref_strs =
+        arena_grow_array(&store->pst_arena, store->pst_ref_strs,
+                         store->pst_ref_count, cap, sizeof(char *));
+    store->pst_ref_lens =
+        arena_grow_array(&store->pst_arena, store->pst_ref_lens,
+                         store->pst_ref_count, cap, sizeof(u32));
+    store->pst_ref_cap = cap;
+  }
+
+  const u32 ref = store->pst_ref_count++;
+  store->pst_ref_strs[ref] = arena_strndup(&store->pst_arena, s, len);
+  store->pst_ref_lens[ref] = len;
+  store->pst_ref_slots[i] = ref + 1;
+  return ref;
+}
+
+static u64 pipeline_store_push(pipeline_store_t *store) {
+  if (store->pst_len == store->pst_cap) {
+    const u64 len = store->pst_len;
+    const u64 cap = store->pst_cap ? store->pst_cap * 2 : 64;
+    arena_t *const arena = &store->pst_arena;
+
+    store->pst_ids = arena_grow_array(arena, store->pst_ids, len, cap,
+                                      sizeof(store->pst_ids[0]));
+    store->pst_created_at =
+        arena_grow_array(arena, store->pst_created_at, len, cap,
+                         sizeof(store->pst_created_at[0]));
+    store->pst_updated_at =
+        arena_grow_array(arena, store->pst_updated_at, len, cap,
+                         sizeof(store->pst_updated_at[0]));
+    store->pst_statuses = arena_grow_array(arena, store->pst_statuses, len, cap,
+                                           sizeof(store->pst_statuses[0]));
+    store->pst_refs = arena_grow_array(arena, store->pst_refs, len, cap,
+                                       sizeof(store->pst_refs[0]));
+    store->pst_urls = arena_grow_array(arena, store->pst_urls, len, cap,
+                                       sizeof(store->pst_urls[0]));
+    store->pst_cap = cap;
+  }
+
+  // Ref 0 is the empty ref, for pipelines missing one.
+  if (store->pst_ref_count == 0) pipeline_store_intern_ref(store, "", 0);
+
+  const u64 row = store->pst_len++;
+  store->pst_ids[row] = 0;
+  store->pst_created_at[row] = 0;
+  store->pst_updated_at[row] = 0;
+  store->pst_statuses[row] = PIP_STATUS_UNKNOWN;
+  store->pst_refs[row] = 0;
+  store->pst_urls[row] = "";
+  return row;
+}
+
+// Write the rows having `status` in `rows` (which must hold at least
+// `pst_len` elements) and return how many there are.
+static u64 pipeline_store_filter_status(const pipeline_store_t *store,
+                                        pipeline_status_t status, u32 *rows) {
+  u64 count = 0;
+  for (u64 i = 0; i < store->pst_len; i++) {
+    rows[count] = i;
+    count += store->pst_statuses[i] == status;
+  }
+  return count;
+}
+
+// Append all the pipelines of `src` to `dst`, copying strings into `dst`'s
+// arena so that `src` can be freed right after.
+static void pipeline_store_append(pipeline_store_t *dst,
+                                  const pipeline_store_t *src) {
+  if (src->pst_ref_count == 0) return;  // Nothing was pushed
+
+  u32 *const refs = malloc(src->pst_ref_count * sizeof(u32));
+  if (refs == NULL) abort();
+  for (u32 ref = 0; ref < src->pst_ref_count; ref++)
+    refs[ref] = pipeline_store_intern_ref(dst, src->pst_ref_strs[ref],
+                                          src->pst_ref_lens[ref]);
+
+  for (u64 i = 0; i < src->pst_len; i++) {
+    const u64 row = pipeline_store_push(dst);
+    dst->pst_ids[row] = src->pst_ids[i];
+    dst->pst_created_at[row] = src->pst_created_at[i];
+    dst->pst_updated_at[row] = src->pst_updated_at[i];
+    dst->pst_statuses[row] = src->pst_statuses[i];
+    dst->pst_refs[row] = refs[src->pst_refs[i]];
+    dst->pst_urls[row] = arena_strndup(&dst->pst_arena, src->pst_urls[i],
+                                       strlen(src->pst_urls[i]));
+  }
+  free(refs);
+}
+
+typedef struct {
+  i64 sk_key;
+  u32 sk_row;
+} sort_key_t;
+
+static int sort_key_cmp_desc(const void *a, const void *b) {
+  const i64 x = ((const sort_key_t *)a)->sk_key,
+            y = ((const sort_key_t *)b)->sk_key;
+  return (x < y) - (x > y);
+}
+
+// Sort `rows` by `updated_at`, most recent first.
+static void pipeline_store_sort_by_updated_at(const pipeline_store_t *store,
+                                              u32 *rows, u64 rows_len) {
+  sort_key_t *keys = malloc(rows_len * sizeof(sort_key_t));
+  if (rows_len && keys == NULL) abort();
+
+  for (u64 i = 0; i < rows_len; i++)
+    keys[i] = (sort_key_t){.sk_key = store->pst_updated_at[rows[i]],
+                           .sk_row = rows[i]};
+  qsort(keys, rows_len, sizeof(sort_key_t), sort_key_cmp_desc);
+  for (u64 i = 0; i < rows_len; i++) rows[i] = keys[i].sk_row;
+
+  free(keys);
+}
+
+// Tokenize `s` into `*tokens` (a buf), growing it as needed. Returns the
+// number of tokens or a negative jsmn error.
+static int json_parse(jsmntok_t **tokens, const char *s, u64 len) {
+  for (;;) {
+    jsmn_parser parser;
+    jsmn_init(&parser);
+
+    const int res =
+        jsmn_parse(&parser, s, len, *tokens, buf_capacity(*tokens));
+    if (res != JSMN_ERROR_NOMEM) return res;
+
+    buf_grow(*tokens, buf_capacity(*tokens));
+  }
+}
+
+// Counters for the summary printed at the end of a poll.
+typedef struct {
+  u64 st_projects, st_pipelines;
+  u64 st_wire_bytes, st_decoded_bytes;
+  bool st_quiet;  // Only print the summary
+} stats_t;
+
+stats_t stats = {0};
+
+#ifdef WITH_ALLOC_STATS
+// Link with `-Wl,--wrap=malloc,--wrap=calloc,--wrap=realloc` to count the
+// allocations made by this translation unit (sds, buf.h, arenas...), i.e. the
+// fetch and parse path, excluding libcurl and libuv internals. Atomic since
+// parse workers allocate too.
+static u64 alloc_count = 0;
+
+void *__real_malloc(size_t size);
+void *__real_calloc(size_t n, size_t size);
+void *__real_realloc(void *p, size_t size);
+
+void *__wrap_malloc(size_t size) {
+  __atomic_fetch_add(&alloc_count, 1, __ATOMIC_RELAXED);
+  return __real_malloc(size);
+}
+
+void *__wrap_calloc(size_t n, size_t size) {
+  __atomic_fetch_add(&alloc_count, 1, __ATOMIC_RELAXED);
+  return __real_calloc(n, size);
+}
+
+void *__wrap_realloc(void *p, size_t size) {
+  __atomic_fetch_add(&alloc_count, 1, __ATOMIC_RELAXED);
+  return __real_realloc(p, size);
+}
+#endif
 
 typedef struct {
   i64 pro_id;
-  sds pro_name, pro_path_with_namespace, pro_api_url, pro_api_data,
-      pro_api_pipelines_url;
-  pipeline_t *pro_pipelines;
+  sds pro_name, pro_path_with_namespace, pro_api_url, pro_api_pipelines_url;
+  pipeline_store_t pro_pipelines;  // From the last complete poll
+  pipeline_store_t pro_polling;    // Filled by the poll in progress
+  // Response bodies as received (compressed) and as handed to the parser.
+  u64 pro_stats_wire_bytes, pro_stats_decoded_bytes;
 } project_t;
 
 project_t *projects = NULL;
 
+// Overridden with `GITLAB_API_URL` e.g. to point at `mock-gitlab`.
+static const char *api_url = "https://gitlab.com/api/v4";
+
 static void project_init(project_t *project, i64 id) {
   project->pro_id = id;
   project->pro_api_url =
-      sdscatprintf(sdsempty(), "https://gitlab.com/api/v4/projects/%lld", id);
-  project->pro_api_data = sdsempty();
-  project->pro_api_pipelines_url = sdscatprintf(
-      sdsempty(), "https://gitlab.com/api/v4/projects/%lld/pipelines", id);
+      sdscatprintf(sdsempty(), "%s/projects/%lld", api_url, (long long)id);
+  project->pro_api_pipelines_url =
+      sdscatprintf(sdsempty(), "%s/projects/%lld/pipelines", api_url,
+                   (long long)id);
 }
 
-static void project_parse_json(project_t *project) {
-  buf_clear(json_tokens);
-
-  jsmn_parser parser;
-  jsmn_init(&parser);
-
-  const char *const s = project->pro_api_data;
-  int res = jsmn_parse(&parser, s, sdslen((char *)s), json_tokens,
-                       sdslen(project->pro_api_data));
+// Runs on a parse worker: the strings are handed back to the loop, which
+// owns `project`.
+static void project_parse_json(const project_t *project, jsmntok_t **tokens,
+                               const char *s, u64 len, sds *name,
+                               sds *path_with_namespace) {
+  const int res = json_parse(tokens, s, len);
+  const jsmntok_t *const json_tokens = *tokens;
   if (res <= 0 || json_tokens[0].type != JSMN_OBJECT) {
     fprintf(stderr, "%s:%d:Malformed JSON for project: id=%lld\n", __FILE__,
-            __LINE__, project->pro_id);
+            __LINE__, (long long)project->pro_id);
     return;
   }
 
   for (i64 i = 1; i < res; i++) {
-    jsmntok_t *const tok = &json_tokens[i];
+    const jsmntok_t *const tok = &json_tokens[i];
     if (tok->type != JSMN_STRING) continue;
 
     if (json_eq(s, tok, "name", sizeof("name") - 1) == 0) {
-      project->pro_name =
+      sdsfree(*name);
+      *name =
           sdsnewlen(s + json_tokens[i + 1].start,
                     json_tokens[i + 1].end - json_tokens[i + 1].start);
       i++;
     } else if (json_eq(s, tok, "path_with_namespace",
                        sizeof("path_with_namespace") - 1) == 0) {
-      project->pro_path_with_namespace =
+      sdsfree(*path_with_namespace);
+      *path_with_namespace =
           sdsnewlen(s + json_tokens[i + 1].start,
                     json_tokens[i + 1].end - json_tokens[i + 1].start);
       i++;
@@ -83,183 +404,1648 @@ static void project_parse_json(project_t *project) {
   }
 }
 
-static void project_parse_pipelines_json(project_t *project) {
-  buf_clear(json_tokens);
-
-  jsmn_parser parser;
-  jsmn_init(&parser);
-
-  const char *const s = project->pro_api_data;
-  int res = jsmn_parse(&parser, s, sdslen((char *)s), json_tokens,
-                       sdslen(project->pro_api_data));
+static void project_parse_pipelines_json(const project_t *project,
+                                         pipeline_store_t *store,
+                                         jsmntok_t **tokens, const char *s,
+                                         u64 len) {
+  const int res = json_parse(tokens, s, len);
+  const jsmntok_t *const json_tokens = *tokens;
   if (res <= 0 || json_tokens[0].type != JSMN_ARRAY) {
     fprintf(stderr, "%s:%d:Malformed JSON for project: id=%lld\n", __FILE__,
-            __LINE__, project->pro_id);
+            __LINE__, (long long)project->pro_id);
     return;
   }
 
-  pipeline_t *pipeline = NULL;
+  i64 row = -1;
   for (i64 i = 1; i < res; i++) {
     const jsmntok_t *const tok = &json_tokens[i];
     if (tok->type == JSMN_OBJECT) {
-      buf_push(project->pro_pipelines, ((pipeline_t){0}));
-      pipeline = &project->pro_pipelines[buf_size(project->pro_pipelines) - 1];
+      row = pipeline_store_push(store);
       continue;
     }
+    if (row < 0 || tok->type != JSMN_STRING || i + 1 >= res) continue;
 
-    if (json_eq(project->pro_api_data, tok, "id", sizeof("id") - 1) == 0) {
-      const jsmntok_t *const t = &json_tokens[++i];
-      const char *const value = project->pro_api_data + t->start;
+    const jsmntok_t *const t = &json_tokens[i + 1];
+    const char *const value = s + t->start;
+    const u32 value_len = t->end - t->start;
+
+    if (json_eq(s, tok, "id", sizeof("id") - 1) == 0) {
       if (t->type != JSMN_PRIMITIVE) {
         fprintf(stderr, "%s:%d:Malformed JSON for project: id=%lld\n", __FILE__,
-                __LINE__, project->pro_id);
+                __LINE__, (long long)project->pro_id);
         return;
       }
-
-      pipeline->pip_id = strtoll(value, NULL, 10);
-    }
-    if (json_eq(project->pro_api_data, tok, "ref", sizeof("ref") - 1) == 0) {
-      const jsmntok_t *const t = &json_tokens[++i];
-      const char *const value = project->pro_api_data + t->start;
-      pipeline->pip_vcs_ref = sdsnewlen(value, t->end - t->start);
-    }
-    if (json_eq(project->pro_api_data, tok, "created_at",
-                sizeof("created_at") - 1) == 0) {
-      const jsmntok_t *const t = &json_tokens[++i];
-      const char *const value = project->pro_api_data + t->start;
-      pipeline->pip_created_at = sdsnewlen(value, t->end - t->start);
+      store->pst_ids[row] = strtoll(value, NULL, 10);
+      i++;
+    } else if (json_eq(s, tok, "ref", sizeof("ref") - 1) == 0) {
+      store->pst_refs[row] = pipeline_store_intern_ref(store, value, value_len);
+      i++;
+    } else if (json_eq(s, tok, "created_at", sizeof("created_at") - 1) == 0) {
+      store->pst_created_at[row] = timestamp_parse(value, value_len);
+      i++;
+    } else if (json_eq(s, tok, "updated_at", sizeof("updated_at") - 1) == 0) {
+      store->pst_updated_at[row] = timestamp_parse(value, value_len);
+      i++;
+    } else if (json_eq(s, tok, "status", sizeof("status") - 1) == 0) {
+      store->pst_statuses[row] = pipeline_status_parse(value, value_len);
+      i++;
+    } else if (json_eq(s, tok, "web_url", sizeof("web_url") - 1) == 0) {
+      store->pst_urls[row] = arena_strndup(&store->pst_arena, value, value_len);
+      i++;
     }
-    if (json_eq(project->pro_api_data, tok, "updated_at",
-                sizeof("updated_at") - 1) == 0) {
-      const jsmntok_t *const t = &json_tokens[++i];
-      const char *const value = project->pro_api_data + t->start;
-      pipeline->pip_updated_at = sdsnewlen(value, t->end - t->start);
+  }
+}
+
+// Drives a curl multi handle from a libuv loop: curl tells us which sockets
+// to watch (`CURLMOPT_SOCKETFUNCTION`) and when to wake it up
+// (`CURLMOPT_TIMERFUNCTION`), we map those onto `uv_poll_t`/`uv_timer_t` and
+// call back into curl with `curl_multi_socket_action`. Nothing blocks, so the
+// same loop can serve other handles (e.g. an HTTP server) meanwhile.
+//
+// All transfers share DNS, TLS sessions and connections through `fe_share`,
+// multiplex over HTTP/2 when the server supports it, and easy handles are
+// recycled through `fe_easy_pool` rather than created for each request, so
+// a whole poll rides on a handful of connections.
+typedef struct fetcher_t fetcher_t;
+
+typedef void (*fetcher_done_cb)(fetcher_t *fetcher, CURL *eh,
+                                CURLcode result);
+
+struct fetcher_t {
+  uv_loop_t *fe_loop;
+  CURLM *fe_multi;
+  CURLSH *fe_share;
+  CURL **fe_easy_pool;
+  uv_timer_t fe_timer;
+  fetcher_done_cb fe_on_done;
+  void *fe_data;
+  u64 fe_stats_transfers, fe_stats_connects;
+};
+
+typedef struct {
+  uv_poll_t fso_poll;
+  curl_socket_t fso_fd;
+  fetcher_t *fso_fetcher;
+} fetcher_socket_t;
+
+// Get an easy handle with the options common to all transfers set.
+static CURL *fetcher_easy_acquire(fetcher_t *fetcher) {
+  CURL *eh = buf_size(fetcher->fe_easy_pool) ? buf_pop(fetcher->fe_easy_pool)
+                                             : curl_easy_init();
+  curl_easy_setopt(eh, CURLOPT_SHARE, fetcher->fe_share);
+  curl_easy_setopt(eh, CURLOPT_HTTP_VERSION, CURL_HTTP_VERSION_2TLS);
+  // Rather wait for an HTTP/2 connection to be up and multiplex on it than
+  // open a new connection per transfer.
+  curl_easy_setopt(eh, CURLOPT_PIPEWAIT, 1L);
+  // Every encoding curl was built with (gzip, brotli...). Bodies are decoded
+  // as they stream in, before reaching `CURLOPT_WRITEFUNCTION`.
+  curl_easy_setopt(eh, CURLOPT_ACCEPT_ENCODING, "");
+  return eh;
+}
+
+// `curl_easy_reset` clears the options but keeps the handle's buffers, and
+// connections and caches live in the share, so the next transfer starts warm.
+static void fetcher_easy_release(fetcher_t *fetcher, CURL *eh) {
+  curl_easy_reset(eh);
+  buf_push(fetcher->fe_easy_pool, eh);
+}
+
+// Abort a transfer still in flight e.g. the loser of a hedged request.
+static void fetcher_cancel(fetcher_t *fetcher, CURL *eh) {
+  curl_multi_remove_handle(fetcher->fe_multi, eh);
+  fetcher_easy_release(fetcher, eh);
+}
+
+static void fetcher_check_multi_info(fetcher_t *fetcher) {
+  CURLMsg *msg;
+  int msgs_left = 0;
+  while ((msg = curl_multi_info_read(fetcher->fe_multi, &msgs_left))) {
+    if (msg->msg != CURLMSG_DONE) {
+      fprintf(stderr, "%s:%d:Unexpected curl message: msg=%d\n", __FILE__,
+              __LINE__, msg->msg);
+      continue;
     }
-    if (json_eq(project->pro_api_data, tok, "status", sizeof("status") - 1) ==
-        0) {
-      const jsmntok_t *const t = &json_tokens[++i];
-      const char *const value = project->pro_api_data + t->start;
-      pipeline->pip_status = sdsnewlen(value, t->end - t->start);
+
+    CURL *const eh = msg->easy_handle;
+    const CURLcode result = msg->data.result;
+    curl_multi_remove_handle(fetcher->fe_multi, eh);
+
+    long connects = 0;
+    curl_easy_getinfo(eh, CURLINFO_NUM_CONNECTS, &connects);
+    fetcher->fe_stats_transfers++;
+    fetcher->fe_stats_connects += connects;
+
+    fetcher->fe_on_done(fetcher, eh, result);
+    fetcher_easy_release(fetcher, eh);
+  }
+}
+
+static void fetcher_on_poll(uv_poll_t *poll, int status, int events) {
+  fetcher_socket_t *const socket = poll->data;
+  fetcher_t *const fetcher = socket->fso_fetcher;
+
+  int flags = 0;
+  if (status < 0) flags = CURL_CSELECT_ERR;
+  if (events & UV_READABLE) flags |= CURL_CSELECT_IN;
+  if (events & UV_WRITABLE) flags |= CURL_CSELECT_OUT;
+
+  int running = 0;
+  curl_multi_socket_action(fetcher->fe_multi, socket->fso_fd, flags, &running);
+  fetcher_check_multi_info(fetcher);
+}
+
+static void fetcher_on_timeout(uv_timer_t *timer) {
+  fetcher_t *const fetcher = timer->data;
+
+  int running = 0;
+  curl_multi_socket_action(fetcher->fe_multi, CURL_SOCKET_TIMEOUT, 0,
+                           &running);
+  fetcher_check_multi_info(fetcher);
+}
+
+static int fetcher_timer_cb(CURLM *multi, long timeout_ms, void *userp) {
+  (void)multi;
+  fetcher_t *const fetcher = userp;
+
+  if (timeout_ms < 0) {
+    uv_timer_stop(&fetcher->fe_timer);
+  } else {
+    // A timeout of 0 means 'now': still go through the loop since curl does
+    // not allow calling `curl_multi_socket_action` from this callback.
+    uv_timer_start(&fetcher->fe_timer, fetcher_on_timeout, timeout_ms, 0);
+  }
+  return 0;
+}
+
+static void fetcher_on_socket_close(uv_handle_t *handle) { free(handle->data); }
+
+static int fetcher_socket_cb(CURL *eh, curl_socket_t fd, int action,
+                             void *userp, void *socketp) {
+  (void)eh;
+  fetcher_t *const fetcher = userp;
+  fetcher_socket_t *socket = socketp;
+
+  if (action == CURL_POLL_REMOVE) {
+    if (socket) {
+      uv_poll_stop(&socket->fso_poll);
+      uv_close((uv_handle_t *)&socket->fso_poll, fetcher_on_socket_close);
+      curl_multi_assign(fetcher->fe_multi, fd, NULL);
     }
-    if (json_eq(project->pro_api_data, tok, "web_url", sizeof("web_url") - 1) ==
-        0) {
-      const jsmntok_t *const t = &json_tokens[++i];
-      const char *const value = project->pro_api_data + t->start;
-      pipeline->pip_url = sdsnewlen(value, t->end - t->start);
+    return 0;
+  }
+
+  if (socket == NULL) {
+    socket = calloc(1, sizeof(fetcher_socket_t));
+    socket->fso_fd = fd;
+    socket->fso_fetcher = fetcher;
+    socket->fso_poll.data = socket;
+
+    int status;
+    if ((status = uv_poll_init_socket(fetcher->fe_loop, &socket->fso_poll,
+                                      fd)) != 0) {
+      fprintf(stderr, "%s:%d:Error uv_poll_init_socket: %s\n", __FILE__,
+              __LINE__, uv_strerror(status));
+      free(socket);
+      return -1;
     }
+    curl_multi_assign(fetcher->fe_multi, fd, socket);
   }
+
+  int events = 0;
+  if (action == CURL_POLL_IN || action == CURL_POLL_INOUT)
+    events |= UV_READABLE;
+  if (action == CURL_POLL_OUT || action == CURL_POLL_INOUT)
+    events |= UV_WRITABLE;
+
+  uv_poll_start(&socket->fso_poll, events, fetcher_on_poll);
+  return 0;
+}
+
+static int fetcher_init(fetcher_t *fetcher, uv_loop_t *loop,
+                        fetcher_done_cb on_done) {
+  fetcher->fe_loop = loop;
+  fetcher->fe_on_done = on_done;
+
+  int status;
+  if ((status = uv_timer_init(loop, &fetcher->fe_timer)) != 0) {
+    fprintf(stderr, "%s:%d:Error uv_timer_init: %s\n", __FILE__, __LINE__,
+            uv_strerror(status));
+    return status;
+  }
+  fetcher->fe_timer.data = fetcher;
+
+  fetcher->fe_share = curl_share_init();
+  curl_share_setopt(fetcher->fe_share, CURLSHOPT_SHARE, CURL_LOCK_DATA_DNS);
+  curl_share_setopt(fetcher->fe_share, CURLSHOPT_SHARE,
+                    CURL_LOCK_DATA_SSL_SESSION);
+  curl_share_setopt(fetcher->fe_share, CURLSHOPT_SHARE, CURL_LOCK_DATA_CONNECT);
+
+  fetcher->fe_multi = curl_multi_init();
+  curl_multi_setopt(fetcher->fe_multi, CURLMOPT_PIPELINING, CURLPIPE_MULTIPLEX);
+  curl_multi_setopt(fetcher->fe_multi, CURLMOPT_SOCKETFUNCTION,
+                    fetcher_socket_cb);
+  curl_multi_setopt(fetcher->fe_multi, CURLMOPT_SOCKETDATA, fetcher);
+  curl_multi_setopt(fetcher->fe_multi, CURLMOPT_TIMERFUNCTION,
+                    fetcher_timer_cb);
+  curl_multi_setopt(fetcher->fe_multi, CURLMOPT_TIMERDATA, fetcher);
+  return 0;
+}
+
+static void fetcher_destroy(fetcher_t *fetcher) {
+  for (u64 i = 0; i < buf_size(fetcher->fe_easy_pool); i++)
+    curl_easy_cleanup(fetcher->fe_easy_pool[i]);
+  buf_free(fetcher->fe_easy_pool);
+
+  curl_multi_cleanup(fetcher->fe_multi);
+  curl_share_cleanup(fetcher->fe_share);
+  uv_close((uv_handle_t *)&fetcher->fe_timer, NULL);
+}
+
+#define PIPELINES_PER_PAGE 100
+#define PIPELINES_MAX_PAGES 10
+
+typedef enum {
+  REQ_PROJECT,
+  REQ_PIPELINES,
+} request_kind_t;
+
+#define REQ_KIND_COUNT (REQ_PIPELINES + 1)
+
+// One API call. Each completed request immediately queues the next one for
+// its project (project -> pipelines page 1 -> page 2...), so projects
+// progress independently of each other instead of phase by phase.
+typedef struct request_t request_t;
+
+struct request_t {
+  request_kind_t req_kind;
+  i64 req_project_i;
+  i64 req_page, req_next_page;
+  sds req_data;
+  CURL *req_easy;  // While in flight
+
+  // For hedging: the other copy of the request, both in flight, if any.
+  request_t *req_hedge;
+  bool req_is_hedge, req_first_byte;
+  u64 req_started_ms;
+
+  u32 req_attempts;
+  u64 req_not_before_ms;  // In `uv_now` time, for retries
+  // From the response headers, -1 when absent.
+  i64 req_ratelimit_remaining, req_ratelimit_reset, req_retry_after;
+};
+
+static void request_reset_response(request_t *request) {
+  sdsclear(request->req_data);
+  request->req_next_page = 0;
+  request->req_ratelimit_remaining = -1;
+  request->req_ratelimit_reset = -1;
+  request->req_retry_after = -1;
 }
 
 static size_t write_cb(char *data, size_t n, size_t l, void *userp) {
-  const i64 project_i = (i64)userp;
-  project_t *project = &projects[project_i];
-  project->pro_api_data = sdscatlen(project->pro_api_data, data, n * l);
+  request_t *const request = userp;
+  request->req_data = sdscatlen(request->req_data, data, n * l);
 
   return n * l;
 }
 
-static void project_fetch_queue(CURLM *cm, int i) {
-  CURL *eh = curl_easy_init();
-  curl_easy_setopt(eh, CURLOPT_WRITEFUNCTION, write_cb);
-  curl_easy_setopt(eh, CURLOPT_URL, projects[i].pro_api_url);
-  curl_easy_setopt(eh, CURLOPT_WRITEDATA, i);
-  curl_easy_setopt(eh, CURLOPT_PRIVATE, i);
-  curl_multi_add_handle(cm, eh);
+// Return the value of the header `name` if `line` is that header, NULL
+// otherwise. `*value_len` excludes the trailing CRLF.
+static const char *header_value(const char *line, u64 len, const char *name,
+                                u64 *value_len) {
+  const u64 name_len = strlen(name);
+  if (len <= name_len || line[name_len] != ':') return NULL;
+  for (u64 i = 0; i < name_len; i++) {
+    char c = line[i];
+    if (c >= 'A' && c <= 'Z') c += 'a' - 'A';
+    char d = name[i];
+    if (d >= 'A' && d <= 'Z') d += 'a' - 'A';
+    if (c != d) return NULL;
+  }
+
+  u64 start = name_len + 1, end = len;
+  while (start < end && line[start] == ' ') start++;
+  while (end > start && (line[end - 1] == '\r' || line[end - 1] == '\n' ||
+                         line[end - 1] == ' '))
+    end--;
+
+  *value_len = end - start;
+  return line + start;
 }
 
-static void project_pipelines_fetch_queue(CURLM *cm, int i) {
-  CURL *eh = curl_easy_init();
+static i64 header_value_i64(const char *value, u64 value_len) {
+  const i64 res = parse_digits(value, value_len);
+  return value_len ? res : -1;
+}
+
+static size_t header_cb(char *line, size_t n, size_t l, void *userp) {
+  request_t *const request = userp;
+  u64 value_len = 0;
+  const char *value;
+
+  request->req_first_byte = true;
+  if ((value = header_value(line, n * l, "X-Next-Page", &value_len)))
+    request->req_next_page = value_len ? strtoll(value, NULL, 10) : 0;
+  else if ((value =
+                header_value(line, n * l, "RateLimit-Remaining", &value_len)))
+    request->req_ratelimit_remaining = header_value_i64(value, value_len);
+  else if ((value = header_value(line, n * l, "RateLimit-Reset", &value_len)))
+    request->req_ratelimit_reset = header_value_i64(value, value_len);
+  // Only the delay-seconds form, an HTTP-date falls back to our own backoff.
+  else if ((value = header_value(line, n * l, "Retry-After", &value_len)))
+    request->req_retry_after = header_value_i64(value, value_len);
+
+  return n * l;
+}
+
+#define SCHEDULER_MIN_RATE 0.1
+#define SCHEDULER_MAX_RATE 1000.0
+#define SCHEDULER_BURST 20.0
+#define SCHEDULER_MAX_ATTEMPTS 5
+#define SCHEDULER_BACKOFF_BASE_MS 500
+#define SCHEDULER_BACKOFF_MAX_MS (60 * 1000)
+#define HEDGE_SAMPLES 256       // Latencies kept per request kind
+#define HEDGE_MIN_SAMPLES 20    // Before that, the p95 means nothing
+#define HEDGE_MIN_DELAY_MS 50   // Never hedge faster than that
+#define HEDGE_BUDGET 0.05       // Hedges, as a fraction of requests
+
+// Token bucket in front of the fetcher: requests wait in `sch_ready` until a
+// token is available. The refill rate follows what GitLab reports in
+// `RateLimit-Remaining`/`RateLimit-Reset`, so a poll runs as fast as the
+// quota allows. Instances without rate limiting never send these headers:
+// until one does, requests are not throttled at all. 429 and 5xx responses
+// are retried with jittered exponential backoff (honouring `Retry-After`)
+// from `sch_delayed`.
+//
+// With hedging on, a request that has not received its first byte after
+// the p95 time to first byte of its kind gets a copy sent on a fresh
+// connection, within `HEDGE_BUDGET`. Whichever answers first is used and
+// the other is cancelled.
+typedef struct {
+  u64 lat_samples_ms[HEDGE_SAMPLES];  // Ring of times to first byte
+  u64 lat_len, lat_p95_ms;
+} latency_t;
+
+typedef struct {
+  fetcher_t *sch_fetcher;
+  uv_timer_t sch_timer;
+
+  request_t **sch_ready;  // FIFO, popped from `sch_ready_head`
+  u64 sch_ready_head;
+  request_t **sch_delayed;
+
+  bool sch_limited;  // Got `RateLimit-*` headers, the bucket applies
+  double sch_tokens, sch_rate;
+  u64 sch_refilled_at_ms, sch_paused_until_ms;
+  u64 sch_rng;
+  u64 sch_stats_retries;
+
+  bool sch_hedge_enabled;
+  uv_timer_t sch_hedge_timer;
+  request_t **sch_in_flight;  // Candidates for hedging
+  latency_t sch_latency[REQ_KIND_COUNT];
+  u64 sch_stats_started, sch_stats_hedged, sch_stats_hedges_won;
+} scheduler_t;
+
+static void scheduler_hedge_arm(scheduler_t *scheduler);
+
+static void request_start(scheduler_t *scheduler, request_t *request) {
+  const project_t *const project = &projects[request->req_project_i];
+  sds url = NULL;
+  switch (request->req_kind) {
+    case REQ_PROJECT:
+      url = sdsdup(project->pro_api_url);
+      break;
+    case REQ_PIPELINES:
+      url = sdscatprintf(sdsempty(), "%s?per_page=%d&page=%lld",
+                         project->pro_api_pipelines_url, PIPELINES_PER_PAGE,
+                         (long long)request->req_page);
+      break;
+  }
+
+  request_reset_response(request);
+  request->req_attempts++;
+  request->req_first_byte = false;
+
+  fetcher_t *const fetcher = scheduler->sch_fetcher;
+  CURL *eh = fetcher_easy_acquire(fetcher);
+  if (request->req_is_hedge) {
+    // The original may be stuck behind a slow connection or stream.
+    curl_easy_setopt(eh, CURLOPT_FRESH_CONNECT, 1L);
+    curl_easy_setopt(eh, CURLOPT_PIPEWAIT, 0L);
+  }
   curl_easy_setopt(eh, CURLOPT_WRITEFUNCTION, write_cb);
-  curl_easy_setopt(eh, CURLOPT_URL, projects[i].pro_api_pipelines_url);
-  curl_easy_setopt(eh, CURLOPT_WRITEDATA, i);
-  curl_easy_setopt(eh, CURLOPT_PRIVATE, i);
-  curl_multi_add_handle(cm, eh);
-}
-
-static void projects_fetch(CURLM *cm) {
-  int still_alive = 1;
-  int msgs_left = -1;
-  do {
-    curl_multi_perform(cm, &still_alive);
-
-    CURLMsg *msg;
-    while ((msg = curl_multi_info_read(cm, &msgs_left))) {
-      CURL *e = msg->easy_handle;
-      i64 project_i = 0;
-      curl_easy_getinfo(msg->easy_handle, CURLINFO_PRIVATE, &project_i);
-
-      project_t *project = &projects[project_i];
-      if (msg->msg == CURLMSG_DONE) {
-        fprintf(stderr, "R: %d - %s\n", msg->data.result,
-                curl_easy_strerror(msg->data.result));
-        curl_multi_remove_handle(cm, e);
-        curl_easy_cleanup(e);
-      } else {
-        fprintf(stderr, "Failed to fetch from API: id=%lld err=%d\n",
-                project->pro_id, msg->msg);
-      }
+  curl_easy_setopt(eh, CURLOPT_WRITEDATA, request);
+  curl_easy_setopt(eh, CURLOPT_HEADERFUNCTION, header_cb);
+  curl_easy_setopt(eh, CURLOPT_HEADERDATA, request);
+  curl_easy_setopt(eh, CURLOPT_URL, url);
+  curl_easy_setopt(eh, CURLOPT_PRIVATE, request);
+  curl_multi_add_handle(fetcher->fe_multi, eh);
+  sdsfree(url);
+
+  request->req_easy = eh;
+  request->req_started_ms = uv_now(fetcher->fe_loop);
+  TRACE_ASYNC_BEGIN(TR_FETCH, (uintptr_t)request, project->pro_id);
+  if (!request->req_is_hedge) scheduler->sch_stats_started++;
+  if (scheduler->sch_hedge_enabled && !request->req_is_hedge) {
+    buf_push(scheduler->sch_in_flight, request);
+    scheduler_hedge_arm(scheduler);
+  }
+}
+
+static void request_free(request_t *request) {
+  sdsfree(request->req_data);
+  free(request);
+}
+
+static void scheduler_on_timer(uv_timer_t *timer);
+
+static void scheduler_kick(scheduler_t *scheduler) {
+  uv_timer_start(&scheduler->sch_timer, scheduler_on_timer, 0, 0);
+}
+
+static void scheduler_dispatch(scheduler_t *scheduler) {
+  uv_loop_t *const loop = scheduler->sch_fetcher->fe_loop;
+  const u64 now = uv_now(loop);
+
+  scheduler->sch_tokens +=
+      (now - scheduler->sch_refilled_at_ms) / 1000.0 * scheduler->sch_rate;
+  if (scheduler->sch_tokens > SCHEDULER_BURST)
+    scheduler->sch_tokens = SCHEDULER_BURST;
+  scheduler->sch_refilled_at_ms = now;
+
+  for (u64 i = 0; i < buf_size(scheduler->sch_delayed);) {
+    request_t *const request = scheduler->sch_delayed[i];
+    if (request->req_not_before_ms > now) {
+      i++;
+      continue;
     }
-    if (still_alive) curl_multi_wait(cm, NULL, 0, 1000, NULL);
+    buf_push(scheduler->sch_ready, request);
+    scheduler->sch_delayed[i] = buf_pop(scheduler->sch_delayed);
+  }
+
+  if (now >= scheduler->sch_paused_until_ms) {
+    while (scheduler->sch_ready_head < buf_size(scheduler->sch_ready) &&
+           (!scheduler->sch_limited || scheduler->sch_tokens >= 1)) {
+      if (scheduler->sch_limited) scheduler->sch_tokens -= 1;
+      request_start(scheduler,
+                    scheduler->sch_ready[scheduler->sch_ready_head++]);
+    }
+  }
+  if (scheduler->sch_ready_head == buf_size(scheduler->sch_ready)) {
+    buf_clear(scheduler->sch_ready);
+    scheduler->sch_ready_head = 0;
+  }
+
+  // Sleep until the next token, pause end or retry, whichever comes first.
+  u64 wake_at = UINT64_MAX;
+  if (buf_size(scheduler->sch_ready)) {
+    const double missing = 1 - scheduler->sch_tokens;
+    wake_at = now + (missing > 0 ? (u64)(missing / scheduler->sch_rate * 1000) +
+                                       1
+                                 : 0);
+    if (wake_at < scheduler->sch_paused_until_ms)
+      wake_at = scheduler->sch_paused_until_ms;
+  }
+  for (u64 i = 0; i < buf_size(scheduler->sch_delayed); i++) {
+    if (scheduler->sch_delayed[i]->req_not_before_ms < wake_at)
+      wake_at = scheduler->sch_delayed[i]->req_not_before_ms;
+  }
 
-  } while (still_alive);
+  if (wake_at == UINT64_MAX)
+    uv_timer_stop(&scheduler->sch_timer);
+  else
+    uv_timer_start(&scheduler->sch_timer, scheduler_on_timer,
+                   wake_at > now ? wake_at - now : 0, 0);
 }
 
-int main() {
-  i64 *project_ids = NULL;
-  buf_push(project_ids, 3472737);
-  buf_push(project_ids, 278964);
+static void scheduler_on_timer(uv_timer_t *timer) {
+  scheduler_dispatch(timer->data);
+}
 
-  curl_global_init(CURL_GLOBAL_ALL);
+static void scheduler_init(scheduler_t *scheduler, fetcher_t *fetcher) {
+  scheduler->sch_fetcher = fetcher;
+  scheduler->sch_rate = SCHEDULER_MAX_RATE;
+  scheduler->sch_tokens = SCHEDULER_BURST;
+  scheduler->sch_refilled_at_ms = uv_now(fetcher->fe_loop);
+  scheduler->sch_rng = uv_hrtime() | 1;
 
-  buf_trunc(json_tokens, 10 * 1024);  // 10 KiB
+  uv_timer_init(fetcher->fe_loop, &scheduler->sch_timer);
+  scheduler->sch_timer.data = scheduler;
+  uv_timer_init(fetcher->fe_loop, &scheduler->sch_hedge_timer);
+  scheduler->sch_hedge_timer.data = scheduler;
+}
 
-  CURLM *cm;
+static void scheduler_destroy(scheduler_t *scheduler) {
+  buf_free(scheduler->sch_ready);
+  buf_free(scheduler->sch_delayed);
+  buf_free(scheduler->sch_in_flight);
+  uv_close((uv_handle_t *)&scheduler->sch_timer, NULL);
+  uv_close((uv_handle_t *)&scheduler->sch_hedge_timer, NULL);
+}
 
-  // Project
-  {
-    cm = curl_multi_init();
-    for (u64 i = 0; i < buf_size(project_ids); i++) {
-      const i64 id = project_ids[i];
+static void request_queue(scheduler_t *scheduler, request_kind_t kind,
+                          i64 project_i, i64 page) {
+  request_t *const request = calloc(1, sizeof(request_t));
+  request->req_kind = kind;
+  request->req_project_i = project_i;
+  request->req_page = page;
+  request->req_data = sdsempty();
 
-      project_t project = {0};
-      project_init(&project, id);
-      buf_push(projects, project);
-      project_fetch_queue(cm, i);
+  buf_push(scheduler->sch_ready, request);
+  scheduler_kick(scheduler);
+}
+
+// Adjust the rate to spread what is left of the quota until it resets.
+static void scheduler_observe(scheduler_t *scheduler,
+                              const request_t *request) {
+  const i64 remaining = request->req_ratelimit_remaining,
+            reset = request->req_ratelimit_reset;
+  if (remaining < 0 || reset < 0) return;
+  scheduler->sch_limited = true;
+
+  i64 seconds_to_reset = reset - (i64)time(NULL);
+  if (seconds_to_reset < 1) seconds_to_reset = 1;
+
+  double rate = (double)remaining / seconds_to_reset;
+  if (rate < SCHEDULER_MIN_RATE) rate = SCHEDULER_MIN_RATE;
+  if (rate > SCHEDULER_MAX_RATE) rate = SCHEDULER_MAX_RATE;
+  scheduler->sch_rate = rate;
+  if (scheduler->sch_tokens > remaining) scheduler->sch_tokens = remaining;
+
+  if (remaining == 0) {
+    const u64 until =
+        uv_now(scheduler->sch_fetcher->fe_loop) + seconds_to_reset * 1000;
+    if (until > scheduler->sch_paused_until_ms)
+      scheduler->sch_paused_until_ms = until;
+  }
+}
+
+static int u64_cmp(const void *a, const void *b) {
+  const u64 x = *(const u64 *)a, y = *(const u64 *)b;
+  return (x > y) - (x < y);
+}
+
+static void latency_record(latency_t *latency, u64 ms) {
+  latency->lat_samples_ms[latency->lat_len++ % HEDGE_SAMPLES] = ms;
+  // Recomputed every few samples: sorting 256 integers is cheap, but not
+  // free. The first time as soon as there are enough of them.
+  if (latency->lat_len < HEDGE_MIN_SAMPLES ||
+      (latency->lat_len != HEDGE_MIN_SAMPLES && latency->lat_len % 8 != 0))
+    return;
+
+  const u64 len =
+      latency->lat_len < HEDGE_SAMPLES ? latency->lat_len : HEDGE_SAMPLES;
+  u64 sorted[HEDGE_SAMPLES];
+  memcpy(sorted, latency->lat_samples_ms, len * sizeof(u64));
+  qsort(sorted, len, sizeof(u64), u64_cmp);
+  latency->lat_p95_ms = sorted[len * 95 / 100];
+}
+
+// When a request of that kind should be hedged, or UINT64_MAX if we do not
+// know enough yet.
+static u64 scheduler_hedge_delay_ms(const scheduler_t *scheduler,
+                                    request_kind_t kind) {
+  const latency_t *const latency = &scheduler->sch_latency[kind];
+  if (latency->lat_len < HEDGE_MIN_SAMPLES) return UINT64_MAX;
+  return latency->lat_p95_ms > HEDGE_MIN_DELAY_MS ? latency->lat_p95_ms
+                                                  : HEDGE_MIN_DELAY_MS;
+}
+
+static void scheduler_forget(scheduler_t *scheduler, const request_t *request) {
+  for (u64 i = 0; i < buf_size(scheduler->sch_in_flight); i++) {
+    if (scheduler->sch_in_flight[i] == request) {
+      scheduler->sch_in_flight[i] = buf_pop(scheduler->sch_in_flight);
+      return;
     }
-    projects_fetch(cm);
-    curl_multi_cleanup(cm);
-
-    for (u64 i = 0; i < buf_size(project_ids); i++) {
-      project_t *project = &projects[i];
-      project_parse_json(project);
-      printf("Project: id=%lld path_with_namespace=%s name=%s\n",
-             project->pro_id, project->pro_path_with_namespace,
-             project->pro_name);
+  }
+}
+
+static bool scheduler_hedge(scheduler_t *scheduler, request_t *request) {
+  if (scheduler->sch_stats_hedged + 1 >
+      HEDGE_BUDGET * scheduler->sch_stats_started)
+    return false;
+  // Hedges count against the rate limit like any other request.
+  const u64 now = uv_now(scheduler->sch_fetcher->fe_loop);
+  if (now < scheduler->sch_paused_until_ms ||
+      (scheduler->sch_limited && scheduler->sch_tokens < 1))
+    return false;
+  if (scheduler->sch_limited) scheduler->sch_tokens -= 1;
+
+  request_t *const hedge = calloc(1, sizeof(request_t));
+  hedge->req_kind = request->req_kind;
+  hedge->req_project_i = request->req_project_i;
+  hedge->req_page = request->req_page;
+  hedge->req_data = sdsempty();
+  hedge->req_attempts = request->req_attempts - 1;
+  hedge->req_is_hedge = true;
+  hedge->req_hedge = request;
+  request->req_hedge = hedge;
+  scheduler->sch_stats_hedged++;
+  TRACE_INSTANT(TR_HEDGE, projects[request->req_project_i].pro_id,
+                request->req_page);
+  request_start(scheduler, hedge);
+  return true;
+}
+
+static void scheduler_on_hedge_timer(uv_timer_t *timer) {
+  scheduler_t *const scheduler = timer->data;
+  const u64 now = uv_now(scheduler->sch_fetcher->fe_loop);
+
+  for (u64 i = 0; i < buf_size(scheduler->sch_in_flight);) {
+    request_t *const request = scheduler->sch_in_flight[i];
+    const u64 delay_ms = scheduler_hedge_delay_ms(scheduler, request->req_kind);
+    // Requests that started answering or were already hedged are done with.
+    // Those out of budget or tokens get another chance at the next tick.
+    if (request->req_first_byte || request->req_hedge != NULL ||
+        (delay_ms != UINT64_MAX && now - request->req_started_ms >= delay_ms &&
+         scheduler_hedge(scheduler, request))) {
+      scheduler->sch_in_flight[i] = buf_pop(scheduler->sch_in_flight);
+      continue;
     }
+    i++;
   }
+  scheduler_hedge_arm(scheduler);
+}
 
-  // Pipelines
-  {
-    cm = curl_multi_init();
-    for (u64 i = 0; i < buf_size(project_ids); i++) {
-      sdsclear(projects[i].pro_api_data);
-      project_pipelines_fetch_queue(cm, i);
+static void scheduler_hedge_arm(scheduler_t *scheduler) {
+  const u64 now = uv_now(scheduler->sch_fetcher->fe_loop);
+  u64 wake_at = UINT64_MAX;
+  for (u64 i = 0; i < buf_size(scheduler->sch_in_flight); i++) {
+    const request_t *const request = scheduler->sch_in_flight[i];
+    const u64 delay_ms = scheduler_hedge_delay_ms(scheduler, request->req_kind);
+    // Unknown p95: check again once a few more requests completed.
+    const u64 at = request->req_started_ms +
+                   (delay_ms != UINT64_MAX ? delay_ms : HEDGE_MIN_DELAY_MS * 4);
+    if (at < wake_at) wake_at = at;
+  }
+
+  if (wake_at == UINT64_MAX)
+    uv_timer_stop(&scheduler->sch_hedge_timer);
+  else
+    uv_timer_start(&scheduler->sch_hedge_timer, scheduler_on_hedge_timer,
+                   wake_at > now ? wake_at - now : HEDGE_MIN_DELAY_MS, 0);
+}
+
+static bool request_is_retryable(CURLcode result, long http_status) {
+  switch (result) {
+    case CURLE_OK:
+      return http_status == 429 || http_status >= 500;
+    case CURLE_COULDNT_RESOLVE_HOST:
+    case CURLE_COULDNT_CONNECT:
+    case CURLE_OPERATION_TIMEDOUT:
+    case CURLE_SEND_ERROR:
+    case CURLE_RECV_ERROR:
+    case CURLE_GOT_NOTHING:
+    case CURLE_PARTIAL_FILE:
+    case CURLE_HTTP2:
+    case CURLE_HTTP2_STREAM:
+      return true;
+    default:
+      return false;
+  }
+}
+
+// Full jitter: uniform in [0, min(max, base * 2^attempts)].
+static u64 scheduler_backoff_ms(scheduler_t *scheduler, u32 attempts) {
+  u64 cap = SCHEDULER_BACKOFF_BASE_MS << (attempts < 16 ? attempts : 16);
+  if (cap > SCHEDULER_BACKOFF_MAX_MS) cap = SCHEDULER_BACKOFF_MAX_MS;
+
+  return xorshift64(&scheduler->sch_rng) % (cap + 1);
+}
+
+static void scheduler_retry(scheduler_t *scheduler, request_t *request,
+                            long http_status) {
+  const u64 now = uv_now(scheduler->sch_fetcher->fe_loop);
+  u64 delay_ms = scheduler_backoff_ms(scheduler, request->req_attempts);
+
+  if (request->req_retry_after >= 0) {
+    const u64 retry_after_ms = (u64)request->req_retry_after * 1000;
+    if (delay_ms < retry_after_ms) delay_ms = retry_after_ms;
+  }
+  // A 429 applies to everyone, not just this request.
+  if (http_status == 429 && now + delay_ms > scheduler->sch_paused_until_ms)
+    scheduler->sch_paused_until_ms = now + delay_ms;
+
+  request->req_not_before_ms = now + delay_ms;
+  buf_push(scheduler->sch_delayed, request);
+  scheduler->sch_stats_retries++;
+  scheduler_kick(scheduler);
+}
+
+// Parsing happens off the loop thread, on a work-stealing pool: each worker
+// owns a deque of jobs (popped from the back, newest first while the body is
+// still hot in cache) and steals from the front of the others' when its own
+// is empty. Each worker has its own jsmn token buffer and each job parses
+// into its own strings or pipeline store and arena, so workers share nothing
+// and never write to `projects`. Finished jobs are handed back to the loop
+// through `po_async`, where they are merged into their project.
+typedef struct {
+  request_t *job_request;
+  sds job_name, job_path_with_namespace;  // For REQ_PROJECT, NULL if absent
+  pipeline_store_t job_pipelines;         // For REQ_PIPELINES
+} parse_job_t;
+
+typedef struct parse_pool_t parse_pool_t;
+
+typedef void (*parse_pool_done_cb)(parse_pool_t *pool, parse_job_t *job);
+
+typedef struct {
+  parse_pool_t *wo_pool;
+  u32 wo_index;
+  uv_thread_t wo_thread;
+  uv_mutex_t wo_mutex;  // Protects the fields below
+  parse_job_t **wo_jobs;
+  u64 wo_jobs_head;
+  parse_job_t **wo_done;
+  jsmntok_t *wo_tokens;  // Only touched by this worker's thread
+} parse_worker_t;
+
+struct parse_pool_t {
+  parse_worker_t *po_workers;
+  u32 po_workers_len, po_next_worker;
+
+  uv_mutex_t po_idle_mutex;  // Protects `po_queued` and `po_stop`
+  uv_cond_t po_idle_cond;
+  u64 po_queued;  // Jobs submitted but not yet claimed by a worker
+  bool po_stop;
+
+  uv_async_t po_async;
+  u64 po_in_flight;  // Loop thread only
+  parse_pool_done_cb po_on_done;
+  void *po_data;
+};
+
+#define PARSE_POOL_MAX_WORKERS 16
+
+static void parse_job_run(parse_worker_t *worker, parse_job_t *job) {
+  request_t *const request = job->job_request;
+  project_t *const project = &projects[request->req_project_i];
+
+  TRACE_BEGIN(TR_PARSE, project->pro_id, sdslen(request->req_data));
+  switch (request->req_kind) {
+    case REQ_PROJECT:
+      project_parse_json(project, &worker->wo_tokens, request->req_data,
+                         sdslen(request->req_data), &job->job_name,
+                         &job->job_path_with_namespace);
+      break;
+    case REQ_PIPELINES:
+      project_parse_pipelines_json(project, &job->job_pipelines,
+                                   &worker->wo_tokens, request->req_data,
+                                   sdslen(request->req_data));
+      break;
+  }
+  TRACE_END(TR_PARSE, job->job_pipelines.pst_len);
+}
+
+static parse_job_t *parse_worker_take(parse_worker_t *worker) {
+  parse_job_t *job = NULL;
+
+  uv_mutex_lock(&worker->wo_mutex);
+  if (worker->wo_jobs_head < buf_size(worker->wo_jobs))
+    job = buf_pop(worker->wo_jobs);
+  if (worker->wo_jobs_head == buf_size(worker->wo_jobs)) {
+    buf_clear(worker->wo_jobs);
+    worker->wo_jobs_head = 0;
+  }
+  uv_mutex_unlock(&worker->wo_mutex);
+  if (job) return job;
+
+  parse_pool_t *const pool = worker->wo_pool;
+  for (u32 i = 1; i < pool->po_workers_len && job == NULL; i++) {
+    parse_worker_t *const victim =
+        &pool->po_workers[(worker->wo_index + i) % pool->po_workers_len];
+
+    uv_mutex_lock(&victim->wo_mutex);
+    if (victim->wo_jobs_head < buf_size(victim->wo_jobs))
+      job = victim->wo_jobs[victim->wo_jobs_head++];
+    if (victim->wo_jobs_head == buf_size(victim->wo_jobs)) {
+      buf_clear(victim->wo_jobs);
+      victim->wo_jobs_head = 0;
     }
-    projects_fetch(cm);
-    curl_multi_cleanup(cm);
-    for (u64 i = 0; i < buf_size(project_ids); i++) {
-      project_t *project = &projects[i];
-      project_parse_pipelines_json(project);
-
-      for (u64 j = 0; j < buf_size(project->pro_pipelines); j++) {
-        const pipeline_t *const pipeline = &project->pro_pipelines[j];
-        printf(
-            "[%lld] Pipeline: id=%lld ref=%s created_at=%s updated_at=%s "
-            "status=%s url=%s\n",
-            project->pro_id, pipeline->pip_id, pipeline->pip_vcs_ref,
-            pipeline->pip_created_at, pipeline->pip_updated_at,
-            pipeline->pip_status, pipeline->pip_url);
+    uv_mutex_unlock(&victim->wo_mutex);
+  }
+  return job;
+}
+
+static void parse_worker_run(void *arg) {
+  parse_worker_t *const worker = arg;
+  parse_pool_t *const pool = worker->wo_pool;
+
+  for (;;) {
+    uv_mutex_lock(&pool->po_idle_mutex);
+    while (pool->po_queued == 0 && !pool->po_stop)
+      uv_cond_wait(&pool->po_idle_cond, &pool->po_idle_mutex);
+    if (pool->po_queued == 0) {
+      uv_mutex_unlock(&pool->po_idle_mutex);
+      return;
+    }
+    pool->po_queued--;
+    uv_mutex_unlock(&pool->po_idle_mutex);
+
+    // Having claimed one, there is a job in some deque for us: we might race
+    // with others for a specific one, but never for the count.
+    parse_job_t *job;
+    while ((job = parse_worker_take(worker)) == NULL) continue;
+
+    parse_job_run(worker, job);
+
+    uv_mutex_lock(&worker->wo_mutex);
+    buf_push(worker->wo_done, job);
+    uv_mutex_unlock(&worker->wo_mutex);
+    uv_async_send(&pool->po_async);
+  }
+}
+
+static void parse_pool_on_async(uv_async_t *async) {
+  parse_pool_t *const pool = async->data;
+
+  for (u32 i = 0; i < pool->po_workers_len; i++) {
+    parse_worker_t *const worker = &pool->po_workers[i];
+
+    uv_mutex_lock(&worker->wo_mutex);
+    parse_job_t **done = worker->wo_done;
+    worker->wo_done = NULL;
+    uv_mutex_unlock(&worker->wo_mutex);
+
+    for (u64 j = 0; j < buf_size(done); j++) {
+      pool->po_in_flight--;
+      pool->po_on_done(pool, done[j]);
+    }
+    buf_free(done);
+  }
+
+  // Only keep the loop alive while there is parsing in progress.
+  if (pool->po_in_flight == 0) uv_unref((uv_handle_t *)&pool->po_async);
+}
+
+static void parse_pool_submit(parse_pool_t *pool, request_t *request) {
+  parse_job_t *const job = calloc(1, sizeof(parse_job_t));
+  job->job_request = request;
+
+  parse_worker_t *const worker = &pool->po_workers[pool->po_next_worker];
+  pool->po_next_worker = (pool->po_next_worker + 1) % pool->po_workers_len;
+
+  uv_mutex_lock(&worker->wo_mutex);
+  buf_push(worker->wo_jobs, job);
+  uv_mutex_unlock(&worker->wo_mutex);
+
+  uv_mutex_lock(&pool->po_idle_mutex);
+  pool->po_queued++;
+  uv_cond_signal(&pool->po_idle_cond);
+  uv_mutex_unlock(&pool->po_idle_mutex);
+
+  if (pool->po_in_flight++ == 0) uv_ref((uv_handle_t *)&pool->po_async);
+}
+
+static int parse_pool_init(parse_pool_t *pool, uv_loop_t *loop,
+                           parse_pool_done_cb on_done, void *data) {
+  pool->po_on_done = on_done;
+  pool->po_data = data;
+
+  u32 workers_len = uv_available_parallelism();
+  if (getenv("GITLAB_PARSE_THREADS") != NULL)
+    workers_len = strtoul(getenv("GITLAB_PARSE_THREADS"), NULL, 10);
+  if (workers_len == 0) workers_len = 1;
+  if (workers_len > PARSE_POOL_MAX_WORKERS)
+    workers_len = PARSE_POOL_MAX_WORKERS;
+
+  int status;
+  if ((status = uv_async_init(loop, &pool->po_async, parse_pool_on_async)) !=
+      0) {
+    fprintf(stderr, "%s:%d:Error uv_async_init: %s\n", __FILE__, __LINE__,
+            uv_strerror(status));
+    return status;
+  }
+  pool->po_async.data = pool;
+  uv_unref((uv_handle_t *)&pool->po_async);
+
+  uv_mutex_init(&pool->po_idle_mutex);
+  uv_cond_init(&pool->po_idle_cond);
+
+  pool->po_workers = calloc(workers_len, sizeof(parse_worker_t));
+  pool->po_workers_len = workers_len;
+  for (u32 i = 0; i < workers_len; i++) {
+    parse_worker_t *const worker = &pool->po_workers[i];
+    worker->wo_pool = pool;
+    worker->wo_index = i;
+    uv_mutex_init(&worker->wo_mutex);
+    buf_trunc(worker->wo_tokens, 10 * 1024);  // 10 KiB
+  }
+  for (u32 i = 0; i < workers_len; i++) {
+    parse_worker_t *const worker = &pool->po_workers[i];
+    if ((status = uv_thread_create(&worker->wo_thread, parse_worker_run,
+                                   worker)) != 0) {
+      fprintf(stderr, "%s:%d:Error uv_thread_create: %s\n", __FILE__,
+              __LINE__, uv_strerror(status));
+      abort();
+    }
+  }
+  return 0;
+}
+
+static void parse_pool_destroy(parse_pool_t *pool) {
+  uv_mutex_lock(&pool->po_idle_mutex);
+  pool->po_stop = true;
+  uv_cond_broadcast(&pool->po_idle_cond);
+  uv_mutex_unlock(&pool->po_idle_mutex);
+
+  for (u32 i = 0; i < pool->po_workers_len; i++) {
+    parse_worker_t *const worker = &pool->po_workers[i];
+    uv_thread_join(&worker->wo_thread);
+    uv_mutex_destroy(&worker->wo_mutex);
+    buf_free(worker->wo_jobs);
+    buf_free(worker->wo_done);
+    buf_free(worker->wo_tokens);
+  }
+  free(pool->po_workers);
+
+  uv_mutex_destroy(&pool->po_idle_mutex);
+  uv_cond_destroy(&pool->po_idle_cond);
+  uv_close((uv_handle_t *)&pool->po_async, NULL);
+}
+
+// String table of a snapshot being written. Strings are deduplicated the same
+// way as `pipeline_store_t` refs, only across all projects.
+typedef struct {
+  char *sw_strings;  // buf
+  u32 *sw_slots;     // Open addressing, holds offset + 1, 0 means empty
+  u32 sw_slots_cap, sw_count;
+} snapshot_strings_t;
+
+static void snapshot_strings_grow(snapshot_strings_t *strings) {
+  const u32 cap = strings->sw_slots_cap ? strings->sw_slots_cap * 2 : 1024;
+  u32 *const slots = calloc(cap, sizeof(u32));
+  if (slots == NULL) abort();
+
+  for (u32 i = 0; i < strings->sw_slots_cap; i++) {
+    const u32 slot = strings->sw_slots[i];
+    if (slot == 0) continue;
+    const char *const s = strings->sw_strings + slot - 1;
+    u32 j = fnv1a(s, strlen(s)) & (cap - 1);
+    while (slots[j]) j = (j + 1) & (cap - 1);
+    slots[j] = slot;
+  }
+  free(strings->sw_slots);
+  strings->sw_slots = slots;
+  strings->sw_slots_cap = cap;
+}
+
+static u32 snapshot_strings_intern(snapshot_strings_t *strings, const char *s,
+                                   u64 len) {
+  if ((strings->sw_count + 1) * 2 > strings->sw_slots_cap)
+    snapshot_strings_grow(strings);
+
+  const u32 mask = strings->sw_slots_cap - 1;
+  u32 i = fnv1a(s, len) & mask;
+  for (; strings->sw_slots[i]; i = (i + 1) & mask) {
+    const char *const cur = strings->sw_strings + strings->sw_slots[i] - 1;
+    if (strncmp(cur, s, len) == 0 && cur[len] == 0)
+      return strings->sw_slots[i] - 1;
+  }
+
+  const u32 off = buf_size(strings->sw_strings);
+  for (u64 j = 0; j < len; j++) buf_push(strings->sw_strings, s[j]);
+  buf_push(strings->sw_strings, 0);
+  strings->sw_slots[i] = off + 1;
+  strings->sw_count++;
+  return off;
+}
+
+static int snapshot_write_file(const char *path, const char *data, u64 len) {
+  // Written next to the final path so that `rename` stays on one filesystem
+  // and readers see either the old or the new snapshot, never a partial one.
+  sds tmp_path = sdscatprintf(sdsempty(), "%s.tmp.%d", path, (int)getpid());
+  const int fd = open(tmp_path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if (fd == -1) {
+    fprintf(stderr, "%s:%d:Error opening snapshot: path=%s err=%s\n", __FILE__,
+            __LINE__, tmp_path, strerror(errno));
+    sdsfree(tmp_path);
+    return -1;
+  }
+
+  u64 written = 0;
+  while (written < len) {
+    const ssize_t res = write(fd, data + written, len - written);
+    if (res == -1 && errno == EINTR) continue;
+    if (res == -1) break;
+    written += res;
+  }
+  // `close` releases the descriptor even when it fails: never call it twice.
+  bool closed = false;
+  if (written < len || fsync(fd) == -1 || (closed = true, close(fd) == -1) ||
+      rename(tmp_path, path) == -1) {
+    fprintf(stderr, "%s:%d:Error writing snapshot: path=%s err=%s\n", __FILE__,
+            __LINE__, tmp_path, strerror(errno));
+    if (!closed) close(fd);
+    unlink(tmp_path);
+    sdsfree(tmp_path);
+    return -1;
+  }
+  sdsfree(tmp_path);
+  return 0;
+}
+
+// Lay out all the pipelines of `projects` in the format described in
+// `snapshot.h`. Returns the file content, to be freed, of size `*len`.
+static char *snapshot_render(u64 *len) {
+  const u64 projects_len = buf_size(projects);
+  u64 pipelines_len = 0;
+  for (u64 i = 0; i < projects_len; i++)
+    pipelines_len += projects[i].pro_pipelines.pst_len;
+  TRACE_BEGIN(TR_SNAPSHOT, projects_len, pipelines_len);
+
+  // First pass: order the rows and fill the string table, whose size is
+  // needed for the layout.
+  snapshot_strings_t strings = {0};
+  snapshot_strings_intern(&strings, "", 0);
+  u32 *const rows = malloc(pipelines_len * sizeof(u32) + 1);
+  u32 *const refs = malloc(pipelines_len * sizeof(u32) + 1);
+  u32 *const urls = malloc(pipelines_len * sizeof(u32) + 1);
+  u32 *const names = malloc(projects_len * 2 * sizeof(u32) + 1);
+  u64 k = 0;
+  for (u64 i = 0; i < projects_len; i++) {
+    const project_t *const project = &projects[i];
+    const pipeline_store_t *const store = &project->pro_pipelines;
+    names[2 * i] = project->pro_name ? snapshot_strings_intern(
+                                           &strings, project->pro_name,
+                                           sdslen(project->pro_name))
+                                     : 0;
+    names[2 * i + 1] =
+        project->pro_path_with_namespace
+            ? snapshot_strings_intern(&strings,
+                                      project->pro_path_with_namespace,
+                                      sdslen(project->pro_path_with_namespace))
+            : 0;
+
+    u32 *const ref_offs = malloc(store->pst_ref_count * sizeof(u32) + 1);
+    for (u32 ref = 0; ref < store->pst_ref_count; ref++)
+      ref_offs[ref] = snapshot_strings_intern(
+          &strings, store->pst_ref_strs[ref], store->pst_ref_lens[ref]);
+
+    for (u64 j = 0; j < store->pst_len; j++) rows[k + j] = j;
+    pipeline_store_sort_by_updated_at(store, rows + k, store->pst_len);
+    for (u64 j = 0; j < store->pst_len; j++, k++) {
+      refs[k] = ref_offs[store->pst_refs[rows[k]]];
+      urls[k] = snapshot_strings_intern(&strings, store->pst_urls[rows[k]],
+                                        strlen(store->pst_urls[rows[k]]));
+    }
+    free(ref_offs);
+  }
+
+  snapshot_header_t h = {
+      .sh_magic = SNAPSHOT_MAGIC,
+      .sh_version = SNAPSHOT_VERSION,
+      .sh_header_size = sizeof(snapshot_header_t),
+      .sh_created_at = time(NULL),
+      .sh_projects_len = projects_len,
+      .sh_pipelines_len = pipelines_len,
+      .sh_strings_size = buf_size(strings.sw_strings),
+  };
+  u64 off = SNAPSHOT_ALIGN(sizeof(snapshot_header_t));
+  h.sh_projects_off = off;
+  off = SNAPSHOT_ALIGN(off + projects_len * sizeof(snapshot_project_t));
+  h.sh_pipeline_ids_off = off;
+  off = SNAPSHOT_ALIGN(off + pipelines_len * sizeof(i64));
+  h.sh_pipeline_created_at_off = off;
+  off = SNAPSHOT_ALIGN(off + pipelines_len * sizeof(i64));
+  h.sh_pipeline_updated_at_off = off;
+  off = SNAPSHOT_ALIGN(off + pipelines_len * sizeof(i64));
+  h.sh_pipeline_refs_off = off;
+  off = SNAPSHOT_ALIGN(off + pipelines_len * sizeof(u32));
+  h.sh_pipeline_urls_off = off;
+  off = SNAPSHOT_ALIGN(off + pipelines_len * sizeof(u32));
+  h.sh_pipeline_statuses_off = off;
+  off = SNAPSHOT_ALIGN(off + pipelines_len * sizeof(u8));
+  h.sh_strings_off = off;
+  h.sh_file_size = off + h.sh_strings_size;
+
+  // Second pass: fill the columns in row order.
+  char *const data = calloc(1, h.sh_file_size);
+  if (data == NULL) abort();
+  memcpy(data, &h, sizeof(h));
+  snapshot_project_t *const out_projects = (void *)(data + h.sh_projects_off);
+  i64 *const ids = (void *)(data + h.sh_pipeline_ids_off);
+  i64 *const created_at = (void *)(data + h.sh_pipeline_created_at_off);
+  i64 *const updated_at = (void *)(data + h.sh_pipeline_updated_at_off);
+  u8 *const statuses = (void *)(data + h.sh_pipeline_statuses_off);
+  k = 0;
+  for (u64 i = 0; i < projects_len; i++) {
+    const pipeline_store_t *const store = &projects[i].pro_pipelines;
+    out_projects[i] = (snapshot_project_t){
+        .sp_id = projects[i].pro_id,
+        .sp_name = names[2 * i],
+        .sp_path_with_namespace = names[2 * i + 1],
+        .sp_pipelines_off = k,
+        .sp_pipelines_len = store->pst_len,
+    };
+    for (u64 j = 0; j < store->pst_len; j++, k++) {
+      ids[k] = store->pst_ids[rows[k]];
+      created_at[k] = store->pst_created_at[rows[k]];
+      updated_at[k] = store->pst_updated_at[rows[k]];
+      statuses[k] = store->pst_statuses[rows[k]];
+    }
+  }
+  memcpy(data + h.sh_pipeline_refs_off, refs, pipelines_len * sizeof(u32));
+  memcpy(data + h.sh_pipeline_urls_off, urls, pipelines_len * sizeof(u32));
+  memcpy(data + h.sh_strings_off, strings.sw_strings, h.sh_strings_size);
+
+  free(names);
+  free(urls);
+  free(refs);
+  free(rows);
+  free(strings.sw_slots);
+  buf_free(strings.sw_strings);
+  TRACE_END(TR_SNAPSHOT, h.sh_file_size);
+  *len = h.sh_file_size;
+  return data;
+}
+
+static int snapshot_write(const char *path) {
+  u64 len = 0;
+  char *const data = snapshot_render(&len);
+  const int res = snapshot_write_file(path, data, len);
+  free(data);
+  return res;
+}
+
+static void project_pipelines_print(const project_t *project) {
+  const pipeline_store_t *const store = &project->pro_pipelines;
+  u32 *const rows = malloc(store->pst_len * sizeof(u32));
+  for (u64 j = 0; j < store->pst_len; j++) rows[j] = j;
+  pipeline_store_sort_by_updated_at(store, rows, store->pst_len);
+
+  for (u64 j = 0; j < store->pst_len; j++) {
+    const u32 row = rows[j];
+    printf(
+        "[%lld] Pipeline: id=%lld ref=%s created_at=%lld updated_at=%lld "
+        "status=%s url=%s\n",
+        (long long)project->pro_id, (long long)store->pst_ids[row],
+        store->pst_ref_strs[store->pst_refs[row]],
+        (long long)store->pst_created_at[row],
+        (long long)store->pst_updated_at[row],
+        pipeline_status_str[store->pst_statuses[row]], store->pst_urls[row]);
+  }
+
+  const u64 failed_count =
+      pipeline_store_filter_status(store, PIP_STATUS_FAILED, rows);
+  const u64 running_count =
+      pipeline_store_filter_status(store, PIP_STATUS_RUNNING, rows);
+  printf("[%lld] Pipelines: count=%llu failed=%llu running=%llu\n",
+         (long long)project->pro_id, (unsigned long long)store->pst_len,
+         (unsigned long long)failed_count, (unsigned long long)running_count);
+  printf("[%lld] Transfer: wire_bytes=%llu decoded_bytes=%llu\n",
+         (long long)project->pro_id,
+         (unsigned long long)project->pro_stats_wire_bytes,
+         (unsigned long long)project->pro_stats_decoded_bytes);
+  free(rows);
+}
+
+#define DAEMON_IDLE_INTERVAL_S 300   // GITLAB_POLL_INTERVAL_S
+#define DAEMON_ACTIVE_INTERVAL_S 30  // GITLAB_POLL_ACTIVE_INTERVAL_S
+#define DAEMON_JITTER 0.2
+#define DAEMON_SNAPSHOT_DELAY_MS 2000
+
+// In daemon mode each project is polled on its own timer, more often while
+// it has pipelines in progress, with jitter so that polls spread over time
+// instead of all projects being hit at once. The fetcher (and so the
+// connections, DNS and TLS sessions in its share) lives as long as the
+// process. The snapshot is rewritten shortly after polls complete, once for
+// all the polls completing in that window: it is rendered on the loop, but
+// written, synced and renamed on the thread pool so that a slow disk does not
+// stall the transfers. One write at a time, a render wanted meanwhile is done
+// when it completes.
+typedef struct {
+  bool dae_enabled, dae_stopping;
+  u64 dae_idle_interval_ms, dae_active_interval_ms;
+  uv_timer_t *dae_timers;  // One per project, same index
+  uv_timer_t dae_snapshot_timer;
+  uv_signal_t dae_sigint, dae_sigterm;
+  const char *dae_snapshot_path;
+  uv_work_t dae_snapshot_work;
+  char *dae_snapshot_data;  // Owned by the write in progress
+  u64 dae_snapshot_len;
+  bool dae_snapshot_writing, dae_snapshot_pending;
+  u64 dae_rng;
+  scheduler_t *dae_scheduler;
+} daemon_t;
+
+// Everything needed to poll GitLab, driven by one loop.
+typedef struct {
+  fetcher_t pol_fetcher;
+  scheduler_t pol_scheduler;
+  parse_pool_t pol_pool;
+  daemon_t pol_daemon;
+} poller_t;
+
+static void daemon_on_timer(uv_timer_t *timer) {
+  daemon_t *const daemon = timer->data;
+  const u64 project_i = timer - daemon->dae_timers;
+  // Project details do not change, only fetch them once.
+  if (projects[project_i].pro_name == NULL)
+    request_queue(daemon->dae_scheduler, REQ_PROJECT, project_i, 0);
+  else
+    request_queue(daemon->dae_scheduler, REQ_PIPELINES, project_i, 1);
+}
+
+// Runs on the thread pool.
+static void daemon_snapshot_work(uv_work_t *work) {
+  daemon_t *const daemon = work->data;
+  snapshot_write_file(daemon->dae_snapshot_path, daemon->dae_snapshot_data,
+                      daemon->dae_snapshot_len);
+}
+
+static void daemon_on_snapshot_timer(uv_timer_t *timer);
+
+static void daemon_snapshot_done(uv_work_t *work, int status) {
+  daemon_t *const daemon = work->data;
+  if (status != 0)
+    fprintf(stderr, "%s:%d:Error writing snapshot: %s\n", __FILE__, __LINE__,
+            uv_strerror(status));
+  free(daemon->dae_snapshot_data);
+  daemon->dae_snapshot_data = NULL;
+  daemon->dae_snapshot_writing = false;
+
+  // When stopping, `main` writes the final snapshot.
+  if (daemon->dae_snapshot_pending && !daemon->dae_stopping)
+    uv_timer_start(&daemon->dae_snapshot_timer, daemon_on_snapshot_timer, 0,
+                   0);
+  daemon->dae_snapshot_pending = false;
+}
+
+static void daemon_on_snapshot_timer(uv_timer_t *timer) {
+  daemon_t *const daemon = timer->data;
+  if (daemon->dae_snapshot_writing) {
+    daemon->dae_snapshot_pending = true;
+    return;
+  }
+
+  daemon->dae_snapshot_data = snapshot_render(&daemon->dae_snapshot_len);
+  daemon->dae_snapshot_work.data = daemon;
+  int status;
+  if ((status = uv_queue_work(timer->loop, &daemon->dae_snapshot_work,
+                              daemon_snapshot_work, daemon_snapshot_done)) !=
+      0) {
+    fprintf(stderr, "%s:%d:Error uv_queue_work: %s\n", __FILE__, __LINE__,
+            uv_strerror(status));
+    free(daemon->dae_snapshot_data);
+    daemon->dae_snapshot_data = NULL;
+    return;
+  }
+  daemon->dae_snapshot_writing = true;
+}
+
+static bool project_is_active(const project_t *project) {
+  const pipeline_store_t *const store = &project->pro_pipelines;
+  for (u64 i = 0; i < store->pst_len; i++) {
+    switch (store->pst_statuses[i]) {
+      case PIP_STATUS_CREATED:
+      case PIP_STATUS_WAITING_FOR_RESOURCE:
+      case PIP_STATUS_PREPARING:
+      case PIP_STATUS_PENDING:
+      case PIP_STATUS_RUNNING:
+        return true;
+      default:
+        break;
+    }
+  }
+  return false;
+}
+
+static void daemon_schedule(daemon_t *daemon, u64 project_i) {
+  if (daemon->dae_stopping) return;
+
+  const u64 interval_ms = project_is_active(&projects[project_i])
+                              ? daemon->dae_active_interval_ms
+                              : daemon->dae_idle_interval_ms;
+  // Uniform in [1 - DAEMON_JITTER, 1 + DAEMON_JITTER] * interval.
+  const double jitter =
+      (xorshift64(&daemon->dae_rng) % 2001 / 1000.0 - 1) * DAEMON_JITTER;
+  uv_timer_start(&daemon->dae_timers[project_i], daemon_on_timer,
+                 interval_ms * (1 + jitter), 0);
+
+  if (daemon->dae_snapshot_path != NULL &&
+      !uv_is_active((uv_handle_t *)&daemon->dae_snapshot_timer))
+    uv_timer_start(&daemon->dae_snapshot_timer, daemon_on_snapshot_timer,
+                   DAEMON_SNAPSHOT_DELAY_MS, 0);
+}
+
+// Stop scheduling polls and let those in flight complete, after which the
+// loop runs out of work and `main` writes the final snapshot. A second
+// signal kills the process since the handlers are gone.
+static void daemon_on_signal(uv_signal_t *signal, int signum) {
+  daemon_t *const daemon = signal->data;
+  fprintf(stderr, "Stopping: signal=%d\n", signum);
+  daemon->dae_stopping = true;
+  for (u64 i = 0; i < buf_size(projects); i++)
+    uv_timer_stop(&daemon->dae_timers[i]);
+  uv_timer_stop(&daemon->dae_snapshot_timer);
+  uv_close((uv_handle_t *)&daemon->dae_sigint, NULL);
+  uv_close((uv_handle_t *)&daemon->dae_sigterm, NULL);
+}
+
+static u64 env_u64(const char *name, u64 default_value) {
+  const char *const value = getenv(name);
+  return value ? strtoull(value, NULL, 10) : default_value;
+}
+
+// Start every project's first poll at a random point of the active interval.
+static void daemon_init(daemon_t *daemon, uv_loop_t *loop,
+                        scheduler_t *scheduler, const char *snapshot_path) {
+  daemon->dae_enabled = true;
+  daemon->dae_scheduler = scheduler;
+  daemon->dae_snapshot_path = snapshot_path;
+  daemon->dae_rng = uv_hrtime() | 1;
+  daemon->dae_idle_interval_ms =
+      env_u64("GITLAB_POLL_INTERVAL_S", DAEMON_IDLE_INTERVAL_S) * 1000;
+  daemon->dae_active_interval_ms =
+      env_u64("GITLAB_POLL_ACTIVE_INTERVAL_S", DAEMON_ACTIVE_INTERVAL_S) * 1000;
+
+  daemon->dae_timers = calloc(buf_size(projects), sizeof(uv_timer_t));
+  for (u64 i = 0; i < buf_size(projects); i++) {
+    uv_timer_init(loop, &daemon->dae_timers[i]);
+    daemon->dae_timers[i].data = daemon;
+    uv_timer_start(&daemon->dae_timers[i], daemon_on_timer,
+                   xorshift64(&daemon->dae_rng) %
+                       (daemon->dae_active_interval_ms + 1),
+                   0);
+  }
+  uv_timer_init(loop, &daemon->dae_snapshot_timer);
+  daemon->dae_snapshot_timer.data = daemon;
+
+  uv_signal_init(loop, &daemon->dae_sigint);
+  uv_signal_init(loop, &daemon->dae_sigterm);
+  daemon->dae_sigint.data = daemon;
+  daemon->dae_sigterm.data = daemon;
+  uv_signal_start(&daemon->dae_sigint, daemon_on_signal, SIGINT);
+  uv_signal_start(&daemon->dae_sigterm, daemon_on_signal, SIGTERM);
+}
+
+// `dae_timers` must only be freed once the loop ran the close callbacks.
+static void daemon_destroy(daemon_t *daemon) {
+  if (!daemon->dae_enabled) return;
+  for (u64 i = 0; i < buf_size(projects); i++)
+    uv_close((uv_handle_t *)&daemon->dae_timers[i], NULL);
+  uv_close((uv_handle_t *)&daemon->dae_snapshot_timer, NULL);
+}
+
+// A poll of a project is over, whether all its pages were fetched or not.
+static void project_poll_done(poller_t *poller, u64 project_i, bool ok) {
+  project_t *const project = &projects[project_i];
+  if (ok) {
+    pipeline_store_free(&project->pro_pipelines);
+    project->pro_pipelines = project->pro_polling;
+    project->pro_polling = (pipeline_store_t){0};
+    stats.st_projects++;
+    if (!stats.st_quiet) project_pipelines_print(project);
+  } else {
+    pipeline_store_free(&project->pro_polling);
+  }
+
+  if (poller->pol_daemon.dae_enabled)
+    daemon_schedule(&poller->pol_daemon, project_i);
+}
+
+static void project_count_bytes(project_t *project, CURL *eh,
+                                const request_t *request) {
+  curl_off_t wire_bytes = 0;
+  curl_easy_getinfo(eh, CURLINFO_SIZE_DOWNLOAD_T, &wire_bytes);
+  project->pro_stats_wire_bytes += wire_bytes;
+  project->pro_stats_decoded_bytes += sdslen(request->req_data);
+  stats.st_wire_bytes += wire_bytes;
+  stats.st_decoded_bytes += sdslen(request->req_data);
+}
+
+static void request_on_done(fetcher_t *fetcher, CURL *eh, CURLcode result) {
+  poller_t *const poller = fetcher->fe_data;
+  scheduler_t *const scheduler = &poller->pol_scheduler;
+  request_t *request = NULL;
+  curl_easy_getinfo(eh, CURLINFO_PRIVATE, (char **)&request);
+  project_t *const project = &projects[request->req_project_i];
+  scheduler_forget(scheduler, request);
+  request->req_easy = NULL;
+  project_count_bytes(project, eh, request);
+
+  long http_status = 0;
+  curl_easy_getinfo(eh, CURLINFO_RESPONSE_CODE, &http_status);
+  TRACE_ASYNC_END(TR_FETCH, (uintptr_t)request, http_status);
+  scheduler_observe(scheduler, request);
+  const bool ok = result == CURLE_OK && http_status >= 200 && http_status < 300;
+
+  // First answer wins. A failure leaves the other copy to finish the job.
+  if (request->req_hedge != NULL) {
+    request_t *const other = request->req_hedge;
+    request->req_hedge = other->req_hedge = NULL;
+    if (!ok) {
+      request_free(request);
+      return;
+    }
+    project_count_bytes(project, other->req_easy, other);
+    // The slow copy still counts, or the p95 would only ever see the fast
+    // ones and drift down. Without a first byte, what it waited so far is a
+    // lower bound.
+    u64 other_ms = uv_now(fetcher->fe_loop) - other->req_started_ms;
+    if (other->req_first_byte) {
+      curl_off_t first_byte_us = 0;
+      curl_easy_getinfo(other->req_easy, CURLINFO_STARTTRANSFER_TIME_T,
+                        &first_byte_us);
+      other_ms = first_byte_us / 1000;
+    }
+    latency_record(&scheduler->sch_latency[other->req_kind], other_ms);
+    TRACE_ASYNC_END(TR_FETCH, (uintptr_t)other, 0);
+    fetcher_cancel(fetcher, other->req_easy);
+    scheduler_forget(scheduler, other);
+    request_free(other);
+    if (request->req_is_hedge) scheduler->sch_stats_hedges_won++;
+  }
+  if (ok) {
+    curl_off_t first_byte_us = 0;
+    curl_easy_getinfo(eh, CURLINFO_STARTTRANSFER_TIME_T, &first_byte_us);
+    latency_record(&scheduler->sch_latency[request->req_kind],
+                   first_byte_us / 1000);
+  }
+
+  if (request_is_retryable(result, http_status) &&
+      request->req_attempts < SCHEDULER_MAX_ATTEMPTS) {
+    fprintf(stderr,
+            "%s:%d:Retrying API call: id=%lld status=%ld err=%s attempt=%u\n",
+            __FILE__, __LINE__, (long long)project->pro_id, http_status,
+            curl_easy_strerror(result), request->req_attempts);
+    TRACE_INSTANT(TR_RETRY, project->pro_id, http_status);
+    scheduler_retry(scheduler, request, http_status);
+    return;
+  }
+
+  if (!ok) {
+    fprintf(stderr,
+            "%s:%d:Failed to fetch from API: id=%lld status=%ld err=%s\n",
+            __FILE__, __LINE__, (long long)project->pro_id, http_status,
+            curl_easy_strerror(result));
+    project_poll_done(poller, request->req_project_i, false);
+    request_free(request);
+    return;
+  }
+
+  parse_pool_submit(&poller->pol_pool, request);
+}
+
+static void request_on_parsed(parse_pool_t *pool, parse_job_t *job) {
+  poller_t *const poller = pool->po_data;
+  scheduler_t *const scheduler = &poller->pol_scheduler;
+  request_t *const request = job->job_request;
+  project_t *const project = &projects[request->req_project_i];
+
+  switch (request->req_kind) {
+    case REQ_PROJECT:
+      if (job->job_name != NULL) {
+        sdsfree(project->pro_name);
+        project->pro_name = job->job_name;
+      }
+      if (job->job_path_with_namespace != NULL) {
+        sdsfree(project->pro_path_with_namespace);
+        project->pro_path_with_namespace = job->job_path_with_namespace;
       }
+      if (!stats.st_quiet)
+        printf("Project: id=%lld path_with_namespace=%s name=%s\n",
+               (long long)project->pro_id, project->pro_path_with_namespace,
+               project->pro_name);
+      request_queue(scheduler, REQ_PIPELINES, request->req_project_i, 1);
+      break;
+
+    case REQ_PIPELINES: {
+      stats.st_pipelines += job->job_pipelines.pst_len;
+      TRACE_BEGIN(TR_MERGE, project->pro_id, job->job_pipelines.pst_len);
+      // The first page is taken as is, later ones are copied over.
+      if (project->pro_polling.pst_len == 0) {
+        pipeline_store_free(&project->pro_polling);
+        project->pro_polling = job->job_pipelines;
+      } else {
+        pipeline_store_append(&project->pro_polling, &job->job_pipelines);
+        pipeline_store_free(&job->job_pipelines);
+      }
+      TRACE_END(TR_MERGE, project->pro_polling.pst_len);
+
+      if (request->req_next_page > request->req_page &&
+          request->req_next_page <= PIPELINES_MAX_PAGES) {
+        request_queue(scheduler, REQ_PIPELINES, request->req_project_i,
+                      request->req_next_page);
+      } else {
+        project_poll_done(poller, request->req_project_i, true);
+      }
+      break;
     }
   }
+  request_free(request);
+  free(job);
+}
+
+// Usage: gitlab-api [-q] [-H] [-d] [-o snapshot_path] [project_id...]
+// With `-q` only the summary is printed (for benchmarks). With `-H` slow
+// requests are hedged (see `scheduler_t`). With `-o` the pipelines are also
+// written to a snapshot (see `snapshot.h`) at the end of the poll. With `-d`
+// projects are polled until SIGINT/SIGTERM (see `daemon_t`). The API base
+// URL is read from `GITLAB_API_URL`.
+int main(int argc, char *argv[]) {
+  i64 *project_ids = NULL;
+  const char *snapshot_path = NULL;
+  bool hedge = false, daemon = false;
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "-q") == 0)
+      stats.st_quiet = true;
+    else if (strcmp(argv[i], "-H") == 0)
+      hedge = true;
+    else if (strcmp(argv[i], "-d") == 0)
+      daemon = true;
+    else if (strcmp(argv[i], "-o") == 0 && i + 1 < argc)
+      snapshot_path = argv[++i];
+    else
+      buf_push(project_ids, strtoll(argv[i], NULL, 10));
+  }
+  if (buf_size(project_ids) == 0) {
+    buf_push(project_ids, 3472737);
+    buf_push(project_ids, 278964);
+  }
+  if (getenv("GITLAB_API_URL") != NULL) api_url = getenv("GITLAB_API_URL");
+
+  curl_global_init(CURL_GLOBAL_ALL);
+
+  uv_loop_t *const loop = uv_default_loop();
+  trace_init(trace_descs, TR_COUNT);
+  trace_signals_start(loop);
+  poller_t poller = {0};
+  if (fetcher_init(&poller.pol_fetcher, loop, request_on_done) != 0) return 1;
+  poller.pol_fetcher.fe_data = &poller;
+  scheduler_init(&poller.pol_scheduler, &poller.pol_fetcher);
+  poller.pol_scheduler.sch_hedge_enabled = hedge;
+  if (parse_pool_init(&poller.pol_pool, loop, request_on_parsed, &poller) != 0)
+    return 1;
+
+  for (u64 i = 0; i < buf_size(project_ids); i++) {
+    project_t project = {0};
+    project_init(&project, project_ids[i]);
+    buf_push(projects, project);
+  }
+  if (daemon) {
+    daemon_init(&poller.pol_daemon, loop, &poller.pol_scheduler,
+                snapshot_path);
+  } else {
+    for (u64 i = 0; i < buf_size(projects); i++)
+      request_queue(&poller.pol_scheduler, REQ_PROJECT, i, 0);
+  }
+  const u64 start_ns = uv_hrtime();
+  uv_run(loop, UV_RUN_DEFAULT);
+  const double elapsed_s = (uv_hrtime() - start_ns) / 1e9;
+
+  int res = 0;
+  if (snapshot_path != NULL) res = snapshot_write(snapshot_path) != 0;
+  for (u64 i = 0; i < buf_size(projects); i++) {
+    pipeline_store_free(&projects[i].pro_pipelines);
+    pipeline_store_free(&projects[i].pro_polling);
+  }
+
+  struct rusage usage = {0};
+  getrusage(RUSAGE_SELF, &usage);
+  fprintf(stderr,
+          "Poll: projects=%llu pipelines=%llu elapsed_s=%.3f projects/s=%.1f "
+          "pipelines/s=%.1f max_rss_kib=%ld\n",
+          (unsigned long long)stats.st_projects,
+          (unsigned long long)stats.st_pipelines, elapsed_s,
+          stats.st_projects / elapsed_s, stats.st_pipelines / elapsed_s,
+          usage.ru_maxrss);
+#ifdef WITH_ALLOC_STATS
+  fprintf(stderr, "Allocations: count=%llu per_pipeline=%.2f\n",
+          (unsigned long long)alloc_count,
+          stats.st_pipelines ? (double)alloc_count / stats.st_pipelines : 0.0);
+#endif
+  fprintf(stderr, "Transfers: count=%llu new_connections=%llu retries=%llu\n",
+          (unsigned long long)poller.pol_fetcher.fe_stats_transfers,
+          (unsigned long long)poller.pol_fetcher.fe_stats_connects,
+          (unsigned long long)poller.pol_scheduler.sch_stats_retries);
+  fprintf(stderr, "Bytes: wire=%llu decoded=%llu ratio=%.2f\n",
+          (unsigned long long)stats.st_wire_bytes,
+          (unsigned long long)stats.st_decoded_bytes,
+          stats.st_wire_bytes
+              ? (double)stats.st_decoded_bytes / stats.st_wire_bytes
+              : 0.0);
+  if (hedge)
+    fprintf(stderr,
+            "Hedging: hedged=%llu won=%llu p95_first_byte_ms: project=%llu "
+            "pipelines=%llu\n",
+            (unsigned long long)poller.pol_scheduler.sch_stats_hedged,
+            (unsigned long long)poller.pol_scheduler.sch_stats_hedges_won,
+            (unsigned long long)poller.pol_scheduler.sch_latency[REQ_PROJECT]
+                .lat_p95_ms,
+            (unsigned long long)poller.pol_scheduler.sch_latency[REQ_PIPELINES]
+                .lat_p95_ms);
+  if (trace_ctx.tc_enabled) trace_dump();
+  trace_signals_stop();
+  daemon_destroy(&poller.pol_daemon);
+  parse_pool_destroy(&poller.pol_pool);
+  scheduler_destroy(&poller.pol_scheduler);
+  fetcher_destroy(&poller.pol_fetcher);
+  buf_free(project_ids);
+  uv_run(loop, UV_RUN_DEFAULT);
+  uv_loop_close(loop);
+  free(poller.pol_daemon.dae_timers);
+  return res;
 }
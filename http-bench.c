@@ -0,0 +1,156 @@
+// Request latency of the main.c server over one keep-alive connection:
+// requests are sent one after the other, each waiting for the full response,
+// so what is measured is the round trip through the transport and the server
+// rather than throughput.
+//
+//   http-bench tcp:HOST:PORT PATH [REQUESTS]
+//   http-bench unix:SOCKET_PATH PATH [REQUESTS]   (@name: abstract namespace)
+//
+// Prints the mean, p50, p99 and max latency in microseconds and the requests
+// per second.
+#include <arpa/inet.h>
+#include <errno.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "common.h"
+
+static u64 now_ns() {
+    struct timespec ts = {0};
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (u64)ts.tv_sec * 1000000000 + (u64)ts.tv_nsec;
+}
+
+static int u64_cmp(const void* a, const void* b) {
+    const u64 x = *(const u64*)a, y = *(const u64*)b;
+    return (x > y) - (x < y);
+}
+
+static int connect_to(const char* addr) {
+    int fd = -1;
+    if (strncmp(addr, "unix:", 5) == 0) {
+        const char* const path = addr + 5;
+        struct sockaddr_un sa = {.sun_family = AF_UNIX};
+        const usize len = strlen(path);
+        if (len == 0 || len >= sizeof(sa.sun_path)) return -1;
+        memcpy(sa.sun_path, path, len);
+        if (path[0] == '@') sa.sun_path[0] = '\0';
+
+        fd = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (fd == -1 ||
+            connect(fd, (struct sockaddr*)&sa,
+                    offsetof(struct sockaddr_un, sun_path) + len) == -1)
+            goto fail;
+        return fd;
+    }
+
+    if (strncmp(addr, "tcp:", 4) == 0) {
+        char host[64] = "";
+        const char* const colon = strrchr(addr + 4, ':');
+        if (colon == NULL || colon - (addr + 4) >= (long)sizeof(host))
+            return -1;
+        memcpy(host, addr + 4, colon - (addr + 4));
+        struct sockaddr_in sa = {.sin_family = AF_INET,
+                                 .sin_port = htons(atoi(colon + 1))};
+        if (inet_pton(AF_INET, host, &sa.sin_addr) != 1) return -1;
+
+        fd = socket(AF_INET, SOCK_STREAM, 0);
+        if (fd == -1 || connect(fd, (struct sockaddr*)&sa, sizeof(sa)) == -1)
+            goto fail;
+        const int one = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+        return fd;
+    }
+    return -1;
+
+fail:
+    fprintf(stderr, "%s:%d:Error connecting: addr=%s err=%s\n", __FILE__,
+            __LINE__, addr, strerror(errno));
+    if (fd != -1) close(fd);
+    return -1;
+}
+
+// Read one response into `buf`, which is reused across calls. Returns its
+// size or -1.
+static i64 read_response(int fd, char* buf, usize cap) {
+    usize len = 0;
+    i64 total = -1;  // Unknown until the headers are in
+    while (total == -1 || (i64)len < total) {
+        if (len == cap) return -1;
+        const ssize_t n = read(fd, buf + len, cap - len);
+        if (n <= 0) return -1;
+        len += n;
+        if (total != -1) continue;
+
+        const char* const end = memmem(buf, len, "\r\n\r\n", 4);
+        if (end == NULL) continue;
+        const char* const cl = memmem(buf, end - buf, "Content-Length:", 15);
+        total = (end + 4 - buf) + (cl ? strtoll(cl + 15, NULL, 10) : 0);
+    }
+    return (i64)len;
+}
+
+int main(int argc, char* argv[]) {
+    if (argc < 3) {
+        fprintf(stderr, "Usage: %s tcp:HOST:PORT|unix:PATH PATH [REQUESTS]\n",
+                argv[0]);
+        return 1;
+    }
+    const u64 requests = argc > 3 ? strtoull(argv[3], NULL, 10) : 10000;
+    if (requests == 0) return 1;
+
+    const int fd = connect_to(argv[1]);
+    if (fd == -1) {
+        fprintf(stderr, "%s:%d:Invalid address: %s\n", __FILE__, __LINE__,
+                argv[1]);
+        return 1;
+    }
+
+    char request[512] = "";
+    const int request_len =
+        snprintf(request, sizeof(request),
+                 "GET %s HTTP/1.1\r\nHost: localhost\r\n\r\n", argv[2]);
+    const usize cap = 16 * 1024 * 1024;
+    char* const buf = malloc(cap);
+    u64* const latencies_ns = calloc(requests, sizeof(u64));
+    if (buf == NULL || latencies_ns == NULL) return 1;
+
+    i64 response_len = 0;
+    const u64 start_ns = now_ns();
+    for (u64 i = 0; i < requests; i++) {
+        const u64 sent_ns = now_ns();
+        if (write(fd, request, request_len) != request_len ||
+            (response_len = read_response(fd, buf, cap)) == -1) {
+            fprintf(stderr, "%s:%d:Error on request %llu: %s\n", __FILE__,
+                    __LINE__, (unsigned long long)i, strerror(errno));
+            return 1;
+        }
+        latencies_ns[i] = now_ns() - sent_ns;
+    }
+    const double elapsed_s = (now_ns() - start_ns) / 1e9;
+
+    u64 sum_ns = 0;
+    for (u64 i = 0; i < requests; i++) sum_ns += latencies_ns[i];
+    qsort(latencies_ns, requests, sizeof(u64), u64_cmp);
+    printf(
+        "%s %s: requests=%llu response_bytes=%lld mean_us=%.1f p50_us=%.1f "
+        "p99_us=%.1f max_us=%.1f requests/s=%.0f\n",
+        argv[1], argv[2], (unsigned long long)requests,
+        (long long)response_len, sum_ns / 1e3 / requests,
+        latencies_ns[requests / 2] / 1e3,
+        latencies_ns[requests * 99 / 100] / 1e3,
+        latencies_ns[requests - 1] / 1e3, requests / elapsed_s);
+
+    free(latencies_ns);
+    free(buf);
+    close(fd);
+    return 0;
+}
@@ -1,33 +1,133 @@
+// Dashboards of the GitLab pipelines polled by gitlab-api, served from the
+// snapshot it writes (`gitlab-api -o`, see snapshot.h):
+//
+//   GET /                        HTML, all projects
+//   GET /projects/:id            HTML, pipelines of one project
+//   GET /api/projects            JSON, all projects
+//   GET /api/projects/:id        JSON, pipelines of one project
+//   GET /api/statuses/:status    JSON, pipelines with that status
+//
+// The data only changes once per poll, so every response is rendered once
+// when the snapshot changes, off the loop, and then served as is with a
+// single write.
+//
+// Usage: main [-u socket_path] [snapshot_path]
+//
+// The server listens on 127.0.0.1:8888 and, with `-u`, on a Unix domain
+// socket too for clients on the same host, which skips the TCP stack. A
+// socket path starting with '@' is in the (Linux) abstract namespace. The
+// snapshot path defaults to pipelines.snapshot.
+#include <errno.h>
+#include <fcntl.h>
 #include <http_parser.h>
+#include <stdarg.h>
+#include <stddef.h>
 #include <stdint.h>
 #include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
 #include <uv.h>
 
 #include "buf.h"
 #include "common.h"
+#include "snapshot.h"
+#include "trace.h"
+
+#include "arena.h"  // Needs buf.h first
 
 typedef struct {
     uv_tcp_t tcp;
+    uv_pipe_t pipe;  // With `-u`
 } server_t;
 
 typedef struct {
-    uv_write_t req;
-    uv_buf_t buf;
-} write_req_t;
+    char ce_path[64];
+    char ce_etag[32];
+    char* ce_response;      // buf: status line, headers and body
+    char* ce_not_modified;  // buf: the 304 for `ce_etag`
+} cache_entry_t;
 
+// Every response for one snapshot. Immutable once published: readers take a
+// reference and drop it when their write is done, the last one frees it.
 typedef struct {
-    uv_tcp_t tcp;
+    cache_entry_t* ca_entries;  // buf, sorted by path
+    u64 ca_refs;
+} cache_t;
+
+typedef struct {
+    union {  // Depends on the listener the client came from
+        uv_stream_t stream;
+        uv_tcp_t tcp;
+        uv_pipe_t pipe;
+    } conn;
     uv_timer_t timer;
     http_parser parser;
+    // Everything a request needs until its response is written: the parsed
+    // fields and the `write_req_t`. Reset when a request starts and no
+    // response is in flight, freed with the client.
+    arena_t arena;
+    u64 writes_pending;
+    char* url;            // abuf in `arena`
+    char* header_field;   // abuf in `arena`
+    char* if_none_match;  // abuf in `arena`
+    bool in_header_value, is_if_none_match, closed;
 } client_t;
 
-#define HTTP_OK                                  \
-    "HTTP/1.1 200 OK\r\n"                        \
-    "Content-Type: text/html; charset=UTF-8\r\n" \
-    "Content-Length: 19\r\n"                     \
-    "Connection: close\r\n"                      \
-    "\r\n"                                       \
-    "<html>Hello</html>"
+typedef struct {
+    uv_write_t req;
+    uv_buf_t buf;
+    client_t* client;
+    cache_t* cache;  // Owner of `buf`, NULL for static responses
+    bool keep_alive;
+} write_req_t;
+
+#define IDLE_TIMEOUT_MS 5000
+#define LISTEN_BACKLOG 128
+
+typedef enum {
+    TR_ACCEPT,
+    TR_READ,
+    TR_ROUTE,
+    TR_WRITE,
+    TR_CLOSE,
+    TR_RENDER,
+    TR_COUNT,
+} trace_id_t;
+
+static const trace_desc_t trace_descs[TR_COUNT] = {
+    [TR_ACCEPT] = {"accept", {"client", NULL}},
+    [TR_READ] = {"read", {"client", "nread"}},
+    [TR_ROUTE] = {"route", {"client", "response_bytes"}},
+    [TR_WRITE] = {"write", {"write_req", "bytes"}},
+    [TR_CLOSE] = {"close", {"client", NULL}},
+    [TR_RENDER] = {"render", {"projects", "pipelines"}},
+};
+
+#define HTTP_NOT_FOUND                   \
+    "HTTP/1.1 404 Not Found\r\n"         \
+    "Content-Type: application/json\r\n" \
+    "Content-Length: 27\r\n"             \
+    "\r\n"                               \
+    "{\"message\":\"404 Not Found\"}"
+
+#define HTTP_METHOD_NOT_ALLOWED          \
+    "HTTP/1.1 405 Method Not Allowed\r\n" \
+    "Content-Type: application/json\r\n" \
+    "Content-Length: 36\r\n"             \
+    "\r\n"                               \
+    "{\"message\":\"405 Method Not Allowed\"}"
+
+#define HTTP_SERVICE_UNAVAILABLE          \
+    "HTTP/1.1 503 Service Unavailable\r\n" \
+    "Content-Type: application/json\r\n"  \
+    "Content-Length: 37\r\n"              \
+    "Retry-After: 10\r\n"                 \
+    "\r\n"                                \
+    "{\"message\":\"503 Service Unavailable\"}"
 
 typedef struct {
     usize str_len;
@@ -108,62 +208,676 @@ void http_response_init(http_response_t* response, http_status_t status,
     }
 }
 
-static void on_client_close(uv_handle_t* handle) { free(handle); }
+static void abuf_append(arena_t* arena, char** b, const char* s, usize len) {
+    for (usize i = 0; i < len; i++) abuf_push(arena, *b, s[i]);
+}
+
+static void json_append_str(char** b, const char* s) {
+    buf_push(*b, '"');
+    for (; *s; s++) {
+        const u8 c = (u8)*s;
+        if (c == '"' || c == '\\') {
+            buf_push(*b, '\\');
+            buf_push(*b, c);
+        } else if (c < 0x20) {
+            buf_printf(b, "\\u%04x", c);
+        } else {
+            buf_push(*b, c);
+        }
+    }
+    buf_push(*b, '"');
+}
+
+static void html_append_str(char** b, const char* s) {
+    for (; *s; s++) {
+        switch (*s) {
+            case '<': buf_append(b, "&lt;", 4); break;
+            case '>': buf_append(b, "&gt;", 4); break;
+            case '&': buf_append(b, "&amp;", 5); break;
+            case '"': buf_append(b, "&quot;", 6); break;
+            default: buf_push(*b, *s);
+        }
+    }
+}
+
+static const char* pipeline_status_name(const snapshot_header_t* h,
+                                        u64 row) {
+    return pipeline_status_str[snapshot_pipeline_statuses(h)[row] %
+                               PIP_STATUS_COUNT];
+}
+
+static void pipeline_render_json(char** b, const snapshot_header_t* h,
+                                 const snapshot_project_t* project, u64 row) {
+    buf_printf(b, "{\"id\":%lld,\"project_id\":%lld,\"ref\":",
+               (long long)snapshot_pipeline_ids(h)[row],
+               (long long)project->sp_id);
+    json_append_str(b, snapshot_str(h, snapshot_pipeline_refs(h)[row]));
+    buf_printf(b, ",\"status\":\"%s\",\"created_at\":%lld,\"updated_at\":%lld,"
+                  "\"web_url\":",
+               pipeline_status_name(h, row),
+               (long long)snapshot_pipeline_created_at(h)[row],
+               (long long)snapshot_pipeline_updated_at(h)[row]);
+    json_append_str(b, snapshot_str(h, snapshot_pipeline_urls(h)[row]));
+    buf_push(*b, '}');
+}
+
+static void project_render_json(char** b, const snapshot_header_t* h,
+                                const snapshot_project_t* project,
+                                bool with_pipelines) {
+    buf_printf(b, "{\"id\":%lld,\"name\":", (long long)project->sp_id);
+    json_append_str(b, snapshot_str(h, project->sp_name));
+    buf_printf(b, ",\"path_with_namespace\":");
+    json_append_str(b, snapshot_str(h, project->sp_path_with_namespace));
+
+    u64 counts[PIP_STATUS_COUNT] = {0};
+    const u64 start = project->sp_pipelines_off,
+              end = start + project->sp_pipelines_len;
+    for (u64 row = start; row < end; row++)
+        counts[snapshot_pipeline_statuses(h)[row] % PIP_STATUS_COUNT]++;
+    buf_printf(b, ",\"pipelines_count\":%llu,\"statuses\":{",
+               (unsigned long long)project->sp_pipelines_len);
+    bool first = true;
+    for (u8 i = 0; i < PIP_STATUS_COUNT; i++) {
+        if (counts[i] == 0) continue;
+        buf_printf(b, "%s\"%s\":%llu", first ? "" : ",", pipeline_status_str[i],
+                   (unsigned long long)counts[i]);
+        first = false;
+    }
+    buf_push(*b, '}');
+
+    // Rows are sorted by `updated_at` descending: the first one is the latest.
+    if (with_pipelines) {
+        buf_printf(b, ",\"pipelines\":[");
+        for (u64 row = start; row < end; row++) {
+            if (row > start) buf_push(*b, ',');
+            pipeline_render_json(b, h, project, row);
+        }
+        buf_push(*b, ']');
+    } else if (end > start) {
+        buf_printf(b, ",\"latest_pipeline\":");
+        pipeline_render_json(b, h, project, start);
+    }
+    buf_push(*b, '}');
+}
+
+static void html_render_begin(char** b, const char* title) {
+    buf_printf(b,
+               "<!DOCTYPE html>\n<html>\n<head>\n<meta charset=\"UTF-8\">\n"
+               "<title>");
+    html_append_str(b, title);
+    buf_printf(b,
+               "</title>\n<style>body{font-family:sans-serif}"
+               "td,th{padding:2px 8px;text-align:left}"
+               ".success{color:green}.failed{color:red}"
+               ".running{color:blue}</style>\n</head>\n<body>\n<h1>");
+    html_append_str(b, title);
+    buf_printf(b, "</h1>\n");
+}
+
+static void html_render_end(char** b, const snapshot_header_t* h) {
+    buf_printf(b, "<p>Snapshot taken at %lld (epoch seconds).</p>\n",
+               (long long)h->sh_created_at);
+    buf_printf(b, "</body>\n</html>\n");
+}
+
+static void pipeline_render_html(char** b, const snapshot_header_t* h,
+                                 u64 row) {
+    const char* const status = pipeline_status_name(h, row);
+    buf_printf(b, "<tr><td><a href=\"");
+    html_append_str(b, snapshot_str(h, snapshot_pipeline_urls(h)[row]));
+    buf_printf(b, "\">%lld</a></td><td>",
+               (long long)snapshot_pipeline_ids(h)[row]);
+    html_append_str(b, snapshot_str(h, snapshot_pipeline_refs(h)[row]));
+    buf_printf(b, "</td><td class=\"%s\">%s</td><td>%lld</td></tr>\n", status,
+               status, (long long)snapshot_pipeline_updated_at(h)[row]);
+}
+
+static void projects_render_html(char** b, const snapshot_header_t* h) {
+    html_render_begin(b, "Pipelines");
+    buf_printf(b,
+               "<table>\n<tr><th>Project</th><th>Pipelines</th>"
+               "<th>Latest</th><th>Ref</th><th>Status</th>"
+               "<th>Updated at</th></tr>\n");
+    const snapshot_project_t* const projects = snapshot_projects(h);
+    for (u64 i = 0; i < h->sh_projects_len; i++) {
+        const snapshot_project_t* const project = &projects[i];
+        buf_printf(b, "<tr><td><a href=\"/projects/%lld\">",
+                   (long long)project->sp_id);
+        html_append_str(b, snapshot_str(h, project->sp_path_with_namespace));
+        buf_printf(b, "</a></td><td>%llu</td>",
+                   (unsigned long long)project->sp_pipelines_len);
+        if (project->sp_pipelines_len) {
+            // Drop the `<tr>` of the row, it is part of the project one.
+            char* row = NULL;
+            pipeline_render_html(&row, h, project->sp_pipelines_off);
+            buf_append(b, row + 4, buf_size(row) - 4);
+            buf_free(row);
+        } else {
+            buf_printf(b, "</tr>\n");
+        }
+    }
+    buf_printf(b, "</table>\n");
+    html_render_end(b, h);
+}
+
+static void project_render_html(char** b, const snapshot_header_t* h,
+                                const snapshot_project_t* project) {
+    html_render_begin(b, snapshot_str(h, project->sp_path_with_namespace));
+    buf_printf(b,
+               "<p><a href=\"/\">All projects</a></p>\n<table>\n"
+               "<tr><th>Pipeline</th><th>Ref</th><th>Status</th>"
+               "<th>Updated at</th></tr>\n");
+    const u64 start = project->sp_pipelines_off,
+              end = start + project->sp_pipelines_len;
+    for (u64 row = start; row < end; row++) pipeline_render_html(b, h, row);
+    buf_printf(b, "</table>\n");
+    html_render_end(b, h);
+}
+
+// Wrap `body` (consumed) into a full response for `path`.
+static void cache_add(cache_t* cache, const char* path,
+                      const char* content_type, char* body) {
+    cache_entry_t entry = {0};
+    snprintf(entry.ce_path, sizeof(entry.ce_path), "%s", path);
+    snprintf(entry.ce_etag, sizeof(entry.ce_etag), "\"%08x-%zx\"",
+             fnv1a(body, buf_size(body)), buf_size(body));
+
+    buf_printf(&entry.ce_response,
+               "HTTP/1.1 200 OK\r\n"
+               "Content-Type: %s\r\n"
+               "Content-Length: %zu\r\n"
+               "Cache-Control: no-cache\r\n"
+               "ETag: %s\r\n"
+               "\r\n",
+               content_type, buf_size(body), entry.ce_etag);
+    buf_append(&entry.ce_response, body, buf_size(body));
+    buf_printf(&entry.ce_not_modified,
+               "HTTP/1.1 304 Not Modified\r\n"
+               "Cache-Control: no-cache\r\n"
+               "ETag: %s\r\n"
+               "\r\n",
+               entry.ce_etag);
+    buf_free(body);
+    buf_push(cache->ca_entries, entry);
+}
+
+static int cache_entry_cmp(const void* a, const void* b) {
+    return strcmp(((const cache_entry_t*)a)->ce_path,
+                  ((const cache_entry_t*)b)->ce_path);
+}
+
+static cache_t* cache_render(const snapshot_header_t* h) {
+    cache_t* cache = calloc(1, sizeof(cache_t));
+    const snapshot_project_t* const projects = snapshot_projects(h);
+    static const char json[] = "application/json";
+    static const char html[] = "text/html; charset=UTF-8";
+    char path[64] = "";
+    char* body = NULL;
 
-static void echo_write(uv_write_t* req, int status) {
+    projects_render_html(&body, h);
+    cache_add(cache, "/", html, body);
+
+    body = NULL;
+    buf_push(body, '[');
+    for (u64 i = 0; i < h->sh_projects_len; i++) {
+        if (i) buf_push(body, ',');
+        project_render_json(&body, h, &projects[i], false);
+    }
+    buf_push(body, ']');
+    cache_add(cache, "/api/projects", json, body);
+
+    for (u64 i = 0; i < h->sh_projects_len; i++) {
+        const snapshot_project_t* const project = &projects[i];
+        body = NULL;
+        project_render_html(&body, h, project);
+        snprintf(path, sizeof(path), "/projects/%lld",
+                 (long long)project->sp_id);
+        cache_add(cache, path, html, body);
+
+        body = NULL;
+        project_render_json(&body, h, project, true);
+        snprintf(path, sizeof(path), "/api/projects/%lld",
+                 (long long)project->sp_id);
+        cache_add(cache, path, json, body);
+    }
+
+    for (u8 status = 0; status < PIP_STATUS_COUNT; status++) {
+        body = NULL;
+        buf_push(body, '[');
+        bool first = true;
+        for (u64 i = 0; i < h->sh_projects_len; i++) {
+            const snapshot_project_t* const project = &projects[i];
+            const u64 start = project->sp_pipelines_off,
+                      end = start + project->sp_pipelines_len;
+            for (u64 row = start; row < end; row++) {
+                if (snapshot_pipeline_statuses(h)[row] != status) continue;
+                if (!first) buf_push(body, ',');
+                pipeline_render_json(&body, h, project, row);
+                first = false;
+            }
+        }
+        buf_push(body, ']');
+        snprintf(path, sizeof(path), "/api/statuses/%s",
+                 pipeline_status_str[status]);
+        cache_add(cache, path, json, body);
+    }
+
+    qsort(cache->ca_entries, buf_size(cache->ca_entries),
+          sizeof(cache_entry_t), cache_entry_cmp);
+    return cache;
+}
+
+static void cache_free(cache_t* cache) {
+    for (u64 i = 0; i < buf_size(cache->ca_entries); i++) {
+        buf_free(cache->ca_entries[i].ce_response);
+        buf_free(cache->ca_entries[i].ce_not_modified);
+    }
+    buf_free(cache->ca_entries);
+    free(cache);
+}
+
+// The published cache: readers on any loop take a reference without a lock.
+// A reader loads `cache_current` and then takes its reference, so a replaced
+// cache keeps the reference of `cache_current` until no reader can still be
+// between the two (quiescent-state based reclamation):
+//   - every loop serving from the cache is registered with
+//     `cache_loop_register` and counts its iterations in a check handle.
+//     Callbacks run to completion, so after a loop counted an iteration none
+//     of its readers is still at the load it did before.
+//   - `cache_publish` retires the previous cache with the count of every
+//     loop, and wakes them up so that idle ones count too.
+//   - the retired cache loses that reference in the check handle of the first
+//     loop which sees every count moved past.
+// Responses being written hold their own reference, so the cache they write
+// from lives until the last one is done.
+static cache_t* cache_current = NULL;
+
+#define CACHE_LOOPS_MAX 16
+
+typedef struct {
+    uv_check_t cl_check;
+    uv_async_t cl_wakeup;
+    u64 cl_passes;  // Iterations counted, only the owner loop writes
+} cache_loop_t;
+
+typedef struct {
+    cache_t* cr_cache;
+    u64 cr_passes[CACHE_LOOPS_MAX];  // Of each loop, when retired
+} cache_retired_t;
+
+static struct {
+    cache_loop_t* cs_loops[CACHE_LOOPS_MAX];  // Registered before serving
+    u32 cs_loops_len;
+    uv_mutex_t cs_retired_lock;  // Publishers and reclaimers, not readers
+    cache_retired_t* cs_retired;  // buf
+    u64 cs_retired_len;
+} cache_state;
+
+static cache_t* cache_acquire() {
+    cache_t* const cache = __atomic_load_n(&cache_current, __ATOMIC_ACQUIRE);
+    if (cache) __atomic_fetch_add(&cache->ca_refs, 1, __ATOMIC_RELAXED);
+    return cache;
+}
+
+static void cache_release(cache_t* cache) {
+    if (cache && __atomic_sub_fetch(&cache->ca_refs, 1, __ATOMIC_ACQ_REL) == 0)
+        cache_free(cache);
+}
+
+static bool cache_retired_quiescent(const cache_retired_t* retired) {
+    for (u32 i = 0; i < cache_state.cs_loops_len; i++) {
+        if (__atomic_load_n(&cache_state.cs_loops[i]->cl_passes,
+                            __ATOMIC_SEQ_CST) == retired->cr_passes[i])
+            return false;
+    }
+    return true;
+}
+
+static void cache_reclaim() {
+    if (__atomic_load_n(&cache_state.cs_retired_len, __ATOMIC_RELAXED) == 0)
+        return;
+
+    uv_mutex_lock(&cache_state.cs_retired_lock);
+    cache_retired_t* const retired = cache_state.cs_retired;
+    for (u64 i = 0; i < buf_size(retired);) {
+        if (!cache_retired_quiescent(&retired[i])) {
+            i++;
+            continue;
+        }
+        cache_release(retired[i].cr_cache);
+        retired[i] = retired[buf_size(retired) - 1];
+        buf_ptr(retired)->size--;
+    }
+    __atomic_store_n(&cache_state.cs_retired_len, buf_size(retired),
+                     __ATOMIC_RELAXED);
+    uv_mutex_unlock(&cache_state.cs_retired_lock);
+}
+
+static void cache_on_check(uv_check_t* check) {
+    cache_loop_t* const loop = check->data;
+    __atomic_store_n(&loop->cl_passes, loop->cl_passes + 1, __ATOMIC_SEQ_CST);
+    cache_reclaim();
+}
+
+static void cache_on_wakeup(uv_async_t* async) { (void)async; }
+
+// Before the loop serves anything and before the first `cache_publish`. The
+// handles do not keep the loop alive.
+static int cache_loop_register(uv_loop_t* uv_loop, cache_loop_t* loop) {
+    if (cache_state.cs_loops_len == CACHE_LOOPS_MAX) return UV_ENOSPC;
+    int status;
+    if (cache_state.cs_loops_len == 0 &&
+        (status = uv_mutex_init(&cache_state.cs_retired_lock)) != 0)
+        return status;
+    if ((status = uv_check_init(uv_loop, &loop->cl_check)) != 0 ||
+        (status = uv_async_init(uv_loop, &loop->cl_wakeup, cache_on_wakeup)) !=
+            0)
+        return status;
+    loop->cl_check.data = loop;
+    uv_check_start(&loop->cl_check, cache_on_check);
+    uv_unref((uv_handle_t*)&loop->cl_check);
+    uv_unref((uv_handle_t*)&loop->cl_wakeup);
+    cache_state.cs_loops[cache_state.cs_loops_len++] = loop;
+    return 0;
+}
+
+static void cache_publish(cache_t* cache) {
+    cache->ca_refs = 1;  // Held by `cache_current`
+    cache_retired_t retired = {
+        .cr_cache =
+            __atomic_exchange_n(&cache_current, cache, __ATOMIC_SEQ_CST),
+    };
+    if (retired.cr_cache == NULL) return;
+
+    for (u32 i = 0; i < cache_state.cs_loops_len; i++)
+        retired.cr_passes[i] = __atomic_load_n(
+            &cache_state.cs_loops[i]->cl_passes, __ATOMIC_SEQ_CST);
+    uv_mutex_lock(&cache_state.cs_retired_lock);
+    buf_push(cache_state.cs_retired, retired);
+    __atomic_store_n(&cache_state.cs_retired_len,
+                     buf_size(cache_state.cs_retired), __ATOMIC_RELAXED);
+    uv_mutex_unlock(&cache_state.cs_retired_lock);
+
+    for (u32 i = 0; i < cache_state.cs_loops_len; i++)
+        uv_async_send(&cache_state.cs_loops[i]->cl_wakeup);
+}
+
+static const cache_entry_t* cache_find(const cache_t* cache,
+                                       const char* path) {
+    cache_entry_t key = {0};
+    snprintf(key.ce_path, sizeof(key.ce_path), "%s", path);
+    return bsearch(&key, cache->ca_entries, buf_size(cache->ca_entries),
+                   sizeof(cache_entry_t), cache_entry_cmp);
+}
+
+typedef struct {
+    uv_work_t rl_work;
+    uv_fs_event_t rl_watcher;
+    const char* rl_path;
+    const char* rl_file_name;  // Last component of `rl_path`
+    cache_t* rl_result;
+    bool rl_running, rl_pending;
+} reloader_t;
+
+// Runs on the thread pool.
+static void reload_work(uv_work_t* work) {
+    reloader_t* reloader = work->data;
+    reloader->rl_result = NULL;
+
+    const int fd = open(reloader->rl_path, O_RDONLY);
+    if (fd == -1) {
+        fprintf(stderr, "%s:%d:Error opening snapshot: path=%s err=%s\n",
+                __FILE__, __LINE__, reloader->rl_path, strerror(errno));
+        return;
+    }
+    struct stat st = {0};
+    void* data = MAP_FAILED;
+    if (fstat(fd, &st) == 0 && st.st_size > 0)
+        data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) {
+        fprintf(stderr, "%s:%d:Error mapping snapshot: path=%s err=%s\n",
+                __FILE__, __LINE__, reloader->rl_path,
+                st.st_size == 0 ? "empty file" : strerror(errno));
+        return;
+    }
+
+    const snapshot_header_t* const h = snapshot_open(data, st.st_size);
+    if (h == NULL) {
+        fprintf(stderr, "%s:%d:Invalid snapshot: path=%s\n", __FILE__,
+                __LINE__, reloader->rl_path);
+    } else {
+        TRACE_BEGIN(TR_RENDER, h->sh_projects_len, h->sh_pipelines_len);
+        reloader->rl_result = cache_render(h);
+        TRACE_END(TR_RENDER, buf_size(reloader->rl_result->ca_entries));
+        printf("Loaded snapshot: projects=%llu pipelines=%llu entries=%zu\n",
+               (unsigned long long)h->sh_projects_len,
+               (unsigned long long)h->sh_pipelines_len,
+               buf_size(reloader->rl_result->ca_entries));
+    }
+    munmap(data, st.st_size);
+}
+
+static void reload_start(reloader_t* reloader);
+
+static void reload_done(uv_work_t* work, int status) {
+    reloader_t* reloader = work->data;
+    reloader->rl_running = false;
     if (status != 0) {
-        fprintf(stderr, "%s:%d:Error writing to the client: %s\n", __FILE__,
+        fprintf(stderr, "%s:%d:Error reloading the snapshot: %s\n", __FILE__,
+                __LINE__, uv_strerror(status));
+    } else if (reloader->rl_result != NULL) {
+        cache_publish(reloader->rl_result);
+        reloader->rl_result = NULL;
+    }
+
+    if (reloader->rl_pending) {
+        reloader->rl_pending = false;
+        reload_start(reloader);
+    }
+}
+
+// At most one render at a time: changes during a render trigger one more.
+static void reload_start(reloader_t* reloader) {
+    if (reloader->rl_running) {
+        reloader->rl_pending = true;
+        return;
+    }
+    reloader->rl_running = true;
+    reloader->rl_work.data = reloader;
+
+    int status;
+    if ((status = uv_queue_work(uv_default_loop(), &reloader->rl_work,
+                                reload_work, reload_done)) != 0) {
+        fprintf(stderr, "%s:%d:Error uv_queue_work: %s\n", __FILE__, __LINE__,
+                uv_strerror(status));
+        reloader->rl_running = false;
+    }
+}
+
+// gitlab-api replaces the snapshot with a rename, which changes its inode,
+// so the directory is watched rather than the file.
+static void on_snapshot_change(uv_fs_event_t* watcher, const char* file_name,
+                               int events, int status) {
+    (void)events;
+    reloader_t* reloader = watcher->data;
+    if (status != 0) {
+        fprintf(stderr, "%s:%d:Error watching the snapshot: %s\n", __FILE__,
                 __LINE__, uv_strerror(status));
+        return;
     }
+    if (file_name != NULL && strcmp(file_name, reloader->rl_file_name) == 0)
+        reload_start(reloader);
+}
+
+static void on_client_timer_close(uv_handle_t* handle) {
+    client_t* client = handle->data;
+    arena_free(&client->arena);
+    free(client);
+}
+
+static void on_client_close(uv_handle_t* handle) {
+    client_t* client = handle->data;
+    uv_close((uv_handle_t*)&client->timer, on_client_timer_close);
+}
+
+static void client_close(client_t* client) {
+    if (client->closed) return;
+    client->closed = true;
+    TRACE_INSTANT(TR_CLOSE, (uintptr_t)client, 0);
+    uv_timer_stop(&client->timer);
+    uv_close((uv_handle_t*)&client->conn, on_client_close);
+}
+
+static void on_response_written(uv_write_t* req, int status) {
     write_req_t* write_req = (write_req_t*)req;
-    /* free(write_req->buf.base); */
-    free(write_req);
+    client_t* client = write_req->client;
+    TRACE_ASYNC_END(TR_WRITE, (uintptr_t)write_req, -status);
+    if (status != 0) {
+        fprintf(stderr, "%s:%d:Error writing to the client: %s\n", __FILE__,
+                __LINE__, uv_strerror(status));
+        client_close(client);
+    } else if (!write_req->keep_alive) {
+        client_close(client);
+    }
+    cache_release(write_req->cache);
+    client->writes_pending--;
+}
+
+static void route(client_t* client, write_req_t* write_req) {
+    if (client->parser.method != HTTP_GET) {
+        write_req->buf = uv_buf_init(HTTP_METHOD_NOT_ALLOWED,
+                                     sizeof(HTTP_METHOD_NOT_ALLOWED) - 1);
+        return;
+    }
+
+    cache_t* const cache = cache_acquire();
+    if (cache == NULL) {
+        write_req->buf = uv_buf_init(HTTP_SERVICE_UNAVAILABLE,
+                                     sizeof(HTTP_SERVICE_UNAVAILABLE) - 1);
+        return;
+    }
+
+    char* const query = strchr(client->url, '?');
+    if (query) *query = '\0';
+    const cache_entry_t* const entry = cache_find(cache, client->url);
+    if (entry == NULL) {
+        cache_release(cache);
+        write_req->buf =
+            uv_buf_init(HTTP_NOT_FOUND, sizeof(HTTP_NOT_FOUND) - 1);
+        return;
+    }
+
+    write_req->cache = cache;
+    if (buf_size(client->if_none_match) &&
+        strcmp(client->if_none_match, entry->ce_etag) == 0)
+        write_req->buf = uv_buf_init(entry->ce_not_modified,
+                                     buf_size(entry->ce_not_modified));
+    else
+        write_req->buf =
+            uv_buf_init(entry->ce_response, buf_size(entry->ce_response));
+}
+
+static int on_message_begin(http_parser* parser) {
+    client_t* client = parser->data;
+    // With pipelining the previous request may still be in use by its write:
+    // its memory is then reclaimed at the next reset instead.
+    if (client->writes_pending == 0)
+        arena_reset(&client->arena, (arena_mark_t){0});
+    client->url = NULL;
+    client->header_field = NULL;
+    client->if_none_match = NULL;
+    client->in_header_value = false;
+    client->is_if_none_match = false;
+    return 0;
+}
+
+static int on_url(http_parser* parser, const char* at, size_t len) {
+    client_t* client = parser->data;
+    abuf_append(&client->arena, &client->url, at, len);
+    return 0;
+}
+
+static int on_header_field(http_parser* parser, const char* at, size_t len) {
+    client_t* client = parser->data;
+    if (client->in_header_value) {
+        buf_clear(client->header_field);
+        client->in_header_value = false;
+    }
+    abuf_append(&client->arena, &client->header_field, at, len);
+    return 0;
+}
+
+static int on_header_value(http_parser* parser, const char* at, size_t len) {
+    client_t* client = parser->data;
+    if (!client->in_header_value) {
+        client->in_header_value = true;
+        client->is_if_none_match =
+            str_eq_ignore_case(client->header_field,
+                               buf_size(client->header_field), "If-None-Match");
+    }
+    if (client->is_if_none_match)
+        abuf_append(&client->arena, &client->if_none_match, at, len);
+    return 0;
 }
 
-static void echo_read(uv_stream_t* stream, ssize_t nread, const uv_buf_t* buf) {
+static int on_message_complete(http_parser* parser) {
+    client_t* client = parser->data;
+    abuf_push(&client->arena, client->url, '\0');
+    abuf_push(&client->arena, client->if_none_match, '\0');
+    buf_ptr(client->if_none_match)->size--;
+
+    write_req_t* write_req = arena_alloc(&client->arena, sizeof(write_req_t));
+    *write_req = (write_req_t){0};
+    client->writes_pending++;
+    write_req->client = client;
+    write_req->keep_alive = http_should_keep_alive(parser);
+    route(client, write_req);
+    TRACE_INSTANT(TR_ROUTE, (uintptr_t)client, write_req->buf.len);
+    TRACE_ASYNC_BEGIN(TR_WRITE, (uintptr_t)write_req, write_req->buf.len);
+
+    int status;
+    if ((status = uv_write((uv_write_t*)write_req, &client->conn.stream,
+                           &write_req->buf, 1, on_response_written)) != 0) {
+        fprintf(stderr, "%s:%d:Error writing to the client: %s\n", __FILE__,
+                __LINE__, uv_strerror(status));
+        TRACE_ASYNC_END(TR_WRITE, (uintptr_t)write_req, -status);
+        cache_release(write_req->cache);
+        client->writes_pending--;
+        client_close(client);
+    }
+    return 0;
+}
+
+static const http_parser_settings parser_settings = {
+    .on_message_begin = on_message_begin,
+    .on_url = on_url,
+    .on_header_field = on_header_field,
+    .on_header_value = on_header_value,
+    .on_message_complete = on_message_complete,
+};
+
+static void on_read(uv_stream_t* stream, ssize_t nread, const uv_buf_t* buf) {
     client_t* client = stream->data;
-    http_parser_settings settings = {0};
 
     if (nread > 0) {
-        write_req_t* req = malloc(sizeof(write_req_t));
-        http_response_t response = {0};
-        str_t body = str_from_c_str0_alloc("Hello, world!");
-        http_response_init(&response, HTTP_STATUS_OK, body, 0);
-
-        req->buf = uv_buf_init(HTTP_OK, sizeof(HTTP_OK) - 1);
-
-        size_t parsed =
-            http_parser_execute(&client->parser, &settings, buf->base, nread);
-        if (client->parser.upgrade) {
-            goto err;
-        } else if (parsed != nread) {
-            goto err;
-        }
-
-        int status;
-        if ((status = uv_write((uv_write_t*)req, stream, &req->buf, 1,
-                               echo_write)) != 0) {
-            fprintf(stderr, "%s:%d:Error writing to the client: %s\n", __FILE__,
-                    __LINE__, uv_strerror(status));
-            goto err;
+        TRACE_BEGIN(TR_READ, (uintptr_t)client, nread);
+        uv_timer_again(&client->timer);
+        const size_t parsed = http_parser_execute(
+            &client->parser, &parser_settings, buf->base, nread);
+        TRACE_END(TR_READ, parsed);
+        if (client->parser.upgrade || parsed != (size_t)nread) {
+            fprintf(stderr, "%s:%d:Error parsing request: %s\n", __FILE__,
+                    __LINE__, http_errno_name(client->parser.http_errno));
+            client_close(client);
         }
-        return;
     } else if (nread < 0) {
-        if (nread != UV_EOF) {
+        if (nread != UV_EOF)
             fprintf(stderr, "%s:%d:Error reading: %s\n", __FILE__, __LINE__,
                     uv_strerror(nread));
-            goto err;
-        }
-        size_t parsed =
-            http_parser_execute(&client->parser, &settings, buf->base, 0);
-        goto ok;
+        client_close(client);
     }
 
-err:
-    uv_timer_stop(&client->timer);
-    uv_close((uv_handle_t*)stream, on_client_close);
-
-ok:
     if (buf) free((void*)buf->base);
 }
 
@@ -177,64 +891,139 @@ static void alloc_cb(uv_handle_t* handle, size_t suggested_size,
 static void connection_close_on_timeout(uv_timer_t* context) {
     client_t* client = (client_t*)context->data;
     printf("Closing connection on timeout\n");
-    uv_close((uv_handle_t*)&client->tcp, on_client_close);
+    client_close(client);
 }
 
-static void on_connection(uv_stream_t* tcp, int status) {
-    server_t* server = tcp->data;
+static void on_connection(uv_stream_t* listener, int status) {
     client_t* client = NULL;
 
     if (status != 0) {
         fprintf(stderr, "%s:%d:Error on_connection: %s\n", __FILE__, __LINE__,
                 uv_strerror(status));
-        goto err;
+        return;
     }
 
-    client = malloc(sizeof(client_t));
+    client = calloc(1, sizeof(client_t));
+    if (listener->type == UV_NAMED_PIPE)
+        uv_pipe_init(uv_default_loop(), &client->conn.pipe, 0);
+    else
+        uv_tcp_init(uv_default_loop(), &client->conn.tcp);
+    uv_timer_init(uv_default_loop(), &client->timer);
+    client->conn.stream.data = client;
+    client->timer.data = client;
+    http_parser_init(&client->parser, HTTP_REQUEST);
+    client->parser.data = client;
 
-    if ((status = uv_tcp_init(uv_default_loop(), &client->tcp)) != 0) {
-        fprintf(stderr, "%s:%d:Error uv_tcp_init: %s\n", __FILE__, __LINE__,
-                uv_strerror(status));
-        goto err;
-    }
-    client->tcp.data = client;
-    if ((status = uv_accept((uv_stream_t*)&server->tcp,
-                            (uv_stream_t*)client)) != 0) {
+    if ((status = uv_accept(listener, &client->conn.stream)) != 0) {
         fprintf(stderr, "%s:%d:Error uv_accept: %s\n", __FILE__, __LINE__,
                 uv_strerror(status));
-        goto err;
+        client_close(client);
+        return;
     }
+    TRACE_INSTANT(TR_ACCEPT, (uintptr_t)client, 0);
+    uv_timer_start(&client->timer, connection_close_on_timeout,
+                   IDLE_TIMEOUT_MS, IDLE_TIMEOUT_MS);
 
-    if ((status = uv_timer_init(uv_default_loop(), &client->timer)) != 0) {
-        fprintf(stderr, "%s:%d:Error uv_timer_init: %s\n", __FILE__, __LINE__,
+    if ((status = uv_read_start(&client->conn.stream, alloc_cb, on_read)) !=
+        0) {
+        fprintf(stderr, "%s:%d:Error uv_read_start: %s\n", __FILE__, __LINE__,
                 uv_strerror(status));
-        goto err;
+        client_close(client);
     }
+}
 
-    client->timer.data = client;
-    uv_timer_start(&client->timer, connection_close_on_timeout, 5000, 0);
+// Whether the socket at `path` is left over by a previous run: nothing
+// accepts on it anymore. A running server is not taken over.
+static bool unix_socket_is_stale(const char* path) {
+    struct stat st = {0};
+    if (stat(path, &st) == -1 || !S_ISSOCK(st.st_mode)) return false;
 
-    if ((status = uv_read_start((uv_stream_t*)client, alloc_cb, echo_read)) !=
-        0) {
-        fprintf(stderr, "%s:%d:Error uv_read_start: %s\n", __FILE__, __LINE__,
+    struct sockaddr_un addr = {.sun_family = AF_UNIX};
+    const usize len = strlen(path);
+    if (len >= sizeof(addr.sun_path)) return false;
+    memcpy(addr.sun_path, path, len);
+    const int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd == -1) return false;
+    const bool stale =
+        connect(fd, (const struct sockaddr*)&addr, sizeof(addr)) == -1 &&
+        errno == ECONNREFUSED;
+    close(fd);
+    return stale;
+}
+
+static int server_listen_unix(server_t* server, const char* path) {
+    int status;
+    if ((status = uv_pipe_init(uv_default_loop(), &server->pipe, 0)) != 0) {
+        fprintf(stderr, "%s:%d:Error uv_pipe_init: %s\n", __FILE__, __LINE__,
                 uv_strerror(status));
-        goto err;
+        return status;
+    }
+    server->pipe.data = server;
+
+    if (path[0] == '@') {
+        // libuv before 1.46 only binds filesystem paths, so an abstract
+        // socket is bound by hand and then handed over.
+        struct sockaddr_un addr = {.sun_family = AF_UNIX};
+        const usize len = strlen(path);
+        if (len > sizeof(addr.sun_path)) {
+            status = UV_ENAMETOOLONG;
+        } else {
+            memcpy(addr.sun_path + 1, path + 1, len - 1);
+            const int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+            if (fd == -1 ||
+                bind(fd, (const struct sockaddr*)&addr,
+                     offsetof(struct sockaddr_un, sun_path) + len) == -1) {
+                status = -errno;
+                if (fd != -1) close(fd);
+            } else {
+                status = uv_pipe_open(&server->pipe, fd);
+            }
+        }
+    } else {
+        // Otherwise the bind fails with `EADDRINUSE`.
+        if (unix_socket_is_stale(path)) unlink(path);
+        status = uv_pipe_bind(&server->pipe, path);
+    }
+    if (status != 0) {
+        fprintf(stderr, "%s:%d:Error binding: path=%s err=%s\n", __FILE__,
+                __LINE__, path, uv_strerror(status));
+        return status;
     }
-    http_parser_init(&client->parser, HTTP_REQUEST);
-    client->parser.data = &client->tcp;
 
-err:
-    if (status != 0 && client != NULL) {
-        uv_close((uv_handle_t*)client, on_client_close);
+    if ((status = uv_listen((uv_stream_t*)&server->pipe, LISTEN_BACKLOG,
+                            on_connection)) != 0) {
+        fprintf(stderr, "%s:%d:Error uv_listen: path=%s err=%s\n", __FILE__,
+                __LINE__, path, uv_strerror(status));
+        return status;
     }
+    return 0;
 }
 
-int main() {
+int main(int argc, char* argv[]) {
     struct sockaddr_in addr;
     uv_ip4_addr("127.0.0.1", 8888, &addr);
 
     server_t server = {0};
     int status = 0;
+    trace_init(trace_descs, TR_COUNT);
+    trace_signals_start(uv_default_loop());
+
+    reloader_t reloader = {0};
+    reloader.rl_path = "pipelines.snapshot";
+    const char* socket_path = NULL;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-u") == 0 && i + 1 < argc)
+            socket_path = argv[++i];
+        else
+            reloader.rl_path = argv[i];
+    }
+
+    static cache_loop_t cache_loop = {0};
+    if ((status = cache_loop_register(uv_default_loop(), &cache_loop)) != 0) {
+        fprintf(stderr, "%s:%d:Error registering the loop: %s\n", __FILE__,
+                __LINE__, uv_strerror(status));
+        return status;
+    }
 
     if ((status = uv_tcp_init(uv_default_loop(), &server.tcp)) != 0) {
         fprintf(stderr, "%s:%d:Error uv_tcp_init: %s\n", __FILE__, __LINE__,
@@ -250,12 +1039,43 @@ int main() {
                 uv_strerror(status));
         return status;
     }
-    if ((status = uv_listen((uv_stream_t*)&server.tcp, 10, on_connection)) !=
-        0) {
+    if ((status = uv_listen((uv_stream_t*)&server.tcp, LISTEN_BACKLOG,
+                            on_connection)) != 0) {
         fprintf(stderr, "%s:%d:Error uv_listen: %s\n", __FILE__, __LINE__,
                 uv_strerror(status));
         return status;
     }
+    if (socket_path != NULL &&
+        (status = server_listen_unix(&server, socket_path)) != 0)
+        return status;
+
+    // Only once listening: failing above must not leave a render running.
+    const char* const slash = strrchr(reloader.rl_path, '/');
+    reloader.rl_file_name = slash ? slash + 1 : reloader.rl_path;
+    char* dir = NULL;
+    if (slash == reloader.rl_path)
+        buf_append(&dir, "/", 1);
+    else if (slash)
+        buf_append(&dir, reloader.rl_path, slash - reloader.rl_path);
+    else
+        buf_append(&dir, ".", 1);
+    buf_push(dir, '\0');
+
+    if ((status = uv_fs_event_init(uv_default_loop(), &reloader.rl_watcher)) !=
+        0) {
+        fprintf(stderr, "%s:%d:Error uv_fs_event_init: %s\n", __FILE__,
+                __LINE__, uv_strerror(status));
+        return status;
+    }
+    reloader.rl_watcher.data = &reloader;
+    if ((status = uv_fs_event_start(&reloader.rl_watcher, on_snapshot_change,
+                                    dir, 0)) != 0) {
+        fprintf(stderr, "%s:%d:Error uv_fs_event_start: path=%s err=%s\n",
+                __FILE__, __LINE__, dir, uv_strerror(status));
+        return status;
+    }
+    buf_free(dir);
+    reload_start(&reloader);
 
     return uv_run(uv_default_loop(), UV_RUN_DEFAULT);
 }
@@ -0,0 +1,539 @@
+// Local stand-in for the subset of the GitLab API used by gitlab-api.c, to
+// load test and profile it offline:
+//
+//   GET /api/v4/projects/:id
+//   GET /api/v4/projects/:id/pipelines?page=&per_page=
+//
+// Configured from the environment:
+//   PORT              Port to listen on (default 8889)
+//   MOCK_PROJECTS     Projects with ids 1..N (default 100)
+//   MOCK_PIPELINES    Pipelines per project (default 100)
+//   MOCK_PER_PAGE     Default page size (default 20, like GitLab)
+//   MOCK_LATENCY_MS   Delay before each response (default 0)
+//   MOCK_SLOW_EVERY   Delay every Nth response by MOCK_SLOW_MS more, to
+//                     simulate a tail of slow requests (default 0: never)
+//   MOCK_SLOW_MS      (default 2000)
+//   MOCK_429_EVERY    Answer every Nth request with a 429 (default 0: never)
+//   MOCK_RATE_LIMIT   Requests allowed per minute, advertised with the
+//                     RateLimit-* headers (default 0: unlimited, no headers)
+//   MOCK_GZIP         Gzip bodies for clients accepting it (default 1)
+//
+// Responses carry an ETag and `If-None-Match` is answered with a 304.
+#include <http_parser.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <uv.h>
+#include <zlib.h>
+
+#include "buf.h"
+#include "common.h"
+
+typedef struct {
+    u64 cfg_projects, cfg_pipelines, cfg_per_page, cfg_latency_ms,
+        cfg_slow_every, cfg_slow_ms, cfg_429_every, cfg_rate_limit, cfg_gzip;
+} config_t;
+
+static config_t config = {0};
+
+static u64 requests_count = 0;
+static u64 rate_limit_window_start = 0, rate_limit_window_count = 0;
+
+typedef struct {
+    uv_tcp_t tcp;
+    uv_timer_t timer;
+    http_parser parser;
+    char* url;            // buf
+    char* header_field;   // buf
+    char* if_none_match;    // buf
+    char* accept_encoding;  // buf
+    bool in_header_value, is_if_none_match, is_accept_encoding, closed;
+    u32 refs;  // The connection itself + responses in flight
+} client_t;
+
+typedef struct {
+    uv_timer_t timer;
+    uv_write_t write_req;
+    client_t* client;
+    char* data;  // buf
+    bool keep_alive;
+} response_t;
+
+#define IDLE_TIMEOUT_MS 30000
+
+static u64 env_u64(const char* name, u64 default_value) {
+    const char* const value = getenv(name);
+    return value ? strtoull(value, NULL, 10) : default_value;
+}
+
+// Value of the query parameter `name` in `query` (`a=1&b=2`), or
+// `default_value`.
+static u64 query_u64(const char* query, const char* name, u64 default_value) {
+    const usize name_len = strlen(name);
+    while (query && *query) {
+        if (strncmp(query, name, name_len) == 0 && query[name_len] == '=')
+            return strtoull(query + name_len + 1, NULL, 10);
+        query = strchr(query, '&');
+        if (query) query++;
+    }
+    return default_value;
+}
+
+static void timestamp_format(char* s, usize len, time_t t) {
+    strftime(s, len, "%Y-%m-%dT%H:%M:%S.000Z", gmtime(&t));
+}
+
+static const char* const pipeline_statuses[] = {
+    "success", "success", "success", "failed",  "success",
+    "running", "success", "canceled", "pending", "success",
+};
+
+static const char* const pipeline_refs[] = {"main", "main", "develop",
+                                            "feature/login", "release/1.0"};
+
+static void project_render(char** body, u64 project_id) {
+    buf_printf(body,
+               "{\"id\":%llu,\"name\":\"project-%llu\","
+               "\"path_with_namespace\":\"mock/project-%llu\","
+               "\"web_url\":\"https://gitlab.example.com/mock/project-%llu\"}",
+               (unsigned long long)project_id, (unsigned long long)project_id,
+               (unsigned long long)project_id, (unsigned long long)project_id);
+}
+
+// Pipelines are listed newest first, like GitLab does.
+static void pipelines_render(char** body, u64 project_id, u64 page,
+                             u64 per_page) {
+    const time_t epoch = 1609459200;  // 2021-01-01T00:00:00Z
+    buf_push(*body, '[');
+    for (u64 i = (page - 1) * per_page;
+         i < page * per_page && i < config.cfg_pipelines; i++) {
+        const u64 n = config.cfg_pipelines - 1 - i;
+        const u64 id = project_id * 1000000 + n;
+        char created_at[32] = "", updated_at[32] = "";
+        timestamp_format(created_at, sizeof(created_at), epoch + n * 3600);
+        timestamp_format(updated_at, sizeof(updated_at),
+                         epoch + n * 3600 + 60 + n % 600);
+
+        buf_printf(
+            body,
+            "%s{\"id\":%llu,\"iid\":%llu,\"project_id\":%llu,"
+            "\"sha\":\"%040llx\",\"ref\":\"%s\",\"status\":\"%s\","
+            "\"source\":\"push\",\"created_at\":\"%s\",\"updated_at\":\"%s\","
+            "\"web_url\":\"https://gitlab.example.com/mock/project-%llu/-/"
+            "pipelines/%llu\"}",
+            i == (page - 1) * per_page ? "" : ",", (unsigned long long)id,
+            (unsigned long long)(n + 1), (unsigned long long)project_id,
+            (unsigned long long)fnv1a((const char*)&id, sizeof(id)),
+            pipeline_refs[n % ARR_SIZE(pipeline_refs)],
+            pipeline_statuses[n % ARR_SIZE(pipeline_statuses)], created_at,
+            updated_at, (unsigned long long)project_id,
+            (unsigned long long)id);
+    }
+    buf_push(*body, ']');
+}
+
+static void gzip_compress(char** out, const char* in, usize len) {
+    z_stream zs = {0};
+    deflateInit2(&zs, Z_DEFAULT_COMPRESSION, Z_DEFLATED, 15 + 16, 8,
+                 Z_DEFAULT_STRATEGY);
+    const uLong bound = deflateBound(&zs, len);
+    buf_grow(*out, (ptrdiff_t)bound);
+
+    zs.next_in = (Bytef*)in;
+    zs.avail_in = len;
+    zs.next_out = (Bytef*)*out;
+    zs.avail_out = bound;
+    deflate(&zs, Z_FINISH);
+    buf_ptr(*out)->size = zs.total_out;
+    deflateEnd(&zs);
+}
+
+static void response_render(char** res, int status, const char* headers,
+                            const char* body, usize body_len) {
+    buf_printf(res,
+               "HTTP/1.1 %d %s\r\n"
+               "Content-Type: application/json\r\n"
+               "Content-Length: %zu\r\n"
+               "%s"
+               "\r\n",
+               status, http_status_str(status), body_len, headers);
+    buf_append(res, body, body_len);
+}
+
+static void route(client_t* client, char** res) {
+    char* headers = NULL;
+    char* body = NULL;
+    int status = HTTP_STATUS_OK;
+    buf_push(headers, '\0');
+    buf_clear(headers);
+
+    requests_count++;
+    if (config.cfg_rate_limit) {
+        const u64 now = (u64)time(NULL);
+        if (now >= rate_limit_window_start + 60) {
+            rate_limit_window_start = now;
+            rate_limit_window_count = 0;
+        }
+        rate_limit_window_count++;
+        const u64 remaining = rate_limit_window_count > config.cfg_rate_limit
+                                  ? 0
+                                  : config.cfg_rate_limit -
+                                        rate_limit_window_count;
+        buf_printf(&headers,
+                   "RateLimit-Limit: %llu\r\nRateLimit-Remaining: %llu\r\n"
+                   "RateLimit-Reset: %llu\r\n",
+                   (unsigned long long)config.cfg_rate_limit,
+                   (unsigned long long)remaining,
+                   (unsigned long long)(rate_limit_window_start + 60));
+        if (rate_limit_window_count > config.cfg_rate_limit) {
+            buf_printf(&headers, "Retry-After: %llu\r\n",
+                       (unsigned long long)(rate_limit_window_start + 60 -
+                                            now));
+            status = HTTP_STATUS_TOO_MANY_REQUESTS;
+            goto end;
+        }
+    }
+    if (config.cfg_429_every && requests_count % config.cfg_429_every == 0) {
+        buf_printf(&headers, "Retry-After: 1\r\n");
+        status = HTTP_STATUS_TOO_MANY_REQUESTS;
+        goto end;
+    }
+
+    if (client->parser.method != HTTP_GET) {
+        status = HTTP_STATUS_METHOD_NOT_ALLOWED;
+        goto end;
+    }
+
+    static const char prefix[] = "/api/v4/projects/";
+    if (strncmp(client->url, prefix, sizeof(prefix) - 1) != 0) {
+        status = HTTP_STATUS_NOT_FOUND;
+        goto end;
+    }
+
+    char* rest = NULL;
+    const u64 project_id =
+        strtoull(client->url + sizeof(prefix) - 1, &rest, 10);
+    if (project_id == 0 || project_id > config.cfg_projects) {
+        status = HTTP_STATUS_NOT_FOUND;
+        goto end;
+    }
+    const char* query = strchr(rest, '?');
+    if (query) query++;
+
+    u64 page = 0, per_page = 0;
+    if (*rest == '\0' || *rest == '?') {
+        project_render(&body, project_id);
+    } else if (strncmp(rest, "/pipelines", sizeof("/pipelines") - 1) == 0 &&
+               (rest[sizeof("/pipelines") - 1] == '\0' ||
+                rest[sizeof("/pipelines") - 1] == '?')) {
+        page = query_u64(query, "page", 1);
+        per_page = query_u64(query, "per_page", config.cfg_per_page);
+        if (page == 0) page = 1;
+        if (per_page == 0 || per_page > 100) per_page = config.cfg_per_page;
+
+        const u64 total_pages =
+            (config.cfg_pipelines + per_page - 1) / per_page;
+        pipelines_render(&body, project_id, page, per_page);
+        buf_printf(&headers,
+                   "X-Page: %llu\r\nX-Per-Page: %llu\r\nX-Total: %llu\r\n"
+                   "X-Total-Pages: %llu\r\n",
+                   (unsigned long long)page, (unsigned long long)per_page,
+                   (unsigned long long)config.cfg_pipelines,
+                   (unsigned long long)total_pages);
+        if (page < total_pages)
+            buf_printf(&headers, "X-Next-Page: %llu\r\n",
+                       (unsigned long long)(page + 1));
+        else
+            buf_printf(&headers, "X-Next-Page: \r\n");
+    } else {
+        status = HTTP_STATUS_NOT_FOUND;
+        goto end;
+    }
+
+    // The data never changes, so the ETag only depends on what is asked.
+    char etag[16] = "";
+    const u64 key[] = {project_id, page, per_page};
+    snprintf(etag, sizeof(etag), "\"%08x\"",
+             fnv1a((const char*)key, sizeof(key)));
+    buf_printf(&headers, "ETag: %s\r\n", etag);
+    if (buf_size(client->if_none_match) &&
+        strcmp(client->if_none_match, etag) == 0) {
+        status = HTTP_STATUS_NOT_MODIFIED;
+        buf_clear(body);
+    }
+
+    buf_printf(&headers, "Vary: Accept-Encoding\r\n");
+    if (config.cfg_gzip && buf_size(body) &&
+        strstr(client->accept_encoding, "gzip") != NULL) {
+        char* compressed = NULL;
+        gzip_compress(&compressed, body, buf_size(body));
+        buf_free(body);
+        body = compressed;
+        buf_printf(&headers, "Content-Encoding: gzip\r\n");
+    }
+
+end:
+    if (status != HTTP_STATUS_OK && status != HTTP_STATUS_NOT_MODIFIED)
+        buf_printf(&body, "{\"message\":\"%d %s\"}", status,
+                   http_status_str(status));
+    response_render(res, status, headers, body, buf_size(body));
+    buf_free(headers);
+    buf_free(body);
+}
+
+static void client_unref(client_t* client) {
+    if (--client->refs) return;
+
+    buf_free(client->url);
+    buf_free(client->header_field);
+    buf_free(client->if_none_match);
+    buf_free(client->accept_encoding);
+    free(client);
+}
+
+static void on_client_timer_close(uv_handle_t* handle) {
+    client_unref(handle->data);
+}
+
+static void on_client_close(uv_handle_t* handle) {
+    client_t* client = handle->data;
+    uv_close((uv_handle_t*)&client->timer, on_client_timer_close);
+}
+
+static void client_close(client_t* client) {
+    if (client->closed) return;
+    client->closed = true;
+    uv_timer_stop(&client->timer);
+    uv_close((uv_handle_t*)&client->tcp, on_client_close);
+}
+
+static void on_response_timer_close(uv_handle_t* handle) {
+    response_t* response = handle->data;
+    client_unref(response->client);
+    buf_free(response->data);
+    free(response);
+}
+
+static void on_response_written(uv_write_t* req, int status) {
+    response_t* response = req->data;
+    if (status != 0) {
+        fprintf(stderr, "%s:%d:Error writing to the client: %s\n", __FILE__,
+                __LINE__, uv_strerror(status));
+        client_close(response->client);
+    } else if (!response->keep_alive) {
+        client_close(response->client);
+    }
+    uv_close((uv_handle_t*)&response->timer, on_response_timer_close);
+}
+
+static void on_response_delay(uv_timer_t* timer) {
+    response_t* response = timer->data;
+    client_t* client = response->client;
+    if (client->closed) {
+        uv_close((uv_handle_t*)&response->timer, on_response_timer_close);
+        return;
+    }
+
+    const uv_buf_t buf = uv_buf_init(response->data, buf_size(response->data));
+    int status;
+    if ((status = uv_write(&response->write_req, (uv_stream_t*)&client->tcp,
+                           &buf, 1, on_response_written)) != 0) {
+        fprintf(stderr, "%s:%d:Error writing to the client: %s\n", __FILE__,
+                __LINE__, uv_strerror(status));
+        client_close(client);
+        uv_close((uv_handle_t*)&response->timer, on_response_timer_close);
+    }
+}
+
+static int on_message_begin(http_parser* parser) {
+    client_t* client = parser->data;
+    buf_clear(client->url);
+    buf_clear(client->header_field);
+    buf_clear(client->if_none_match);
+    buf_clear(client->accept_encoding);
+    client->in_header_value = false;
+    client->is_if_none_match = false;
+    client->is_accept_encoding = false;
+    return 0;
+}
+
+static int on_url(http_parser* parser, const char* at, size_t len) {
+    client_t* client = parser->data;
+    buf_append(&client->url, at, len);
+    return 0;
+}
+
+static int on_header_field(http_parser* parser, const char* at, size_t len) {
+    client_t* client = parser->data;
+    if (client->in_header_value) {
+        buf_clear(client->header_field);
+        client->in_header_value = false;
+    }
+    buf_append(&client->header_field, at, len);
+    return 0;
+}
+
+static int on_header_value(http_parser* parser, const char* at, size_t len) {
+    client_t* client = parser->data;
+    if (!client->in_header_value) {
+        client->in_header_value = true;
+        client->is_if_none_match =
+            str_eq_ignore_case(client->header_field,
+                               buf_size(client->header_field), "If-None-Match");
+        client->is_accept_encoding = str_eq_ignore_case(
+            client->header_field, buf_size(client->header_field),
+            "Accept-Encoding");
+    }
+    if (client->is_if_none_match)
+        buf_append(&client->if_none_match, at, len);
+    if (client->is_accept_encoding)
+        buf_append(&client->accept_encoding, at, len);
+    return 0;
+}
+
+static int on_message_complete(http_parser* parser) {
+    client_t* client = parser->data;
+    buf_push(client->url, '\0');
+    buf_push(client->if_none_match, '\0');
+    buf_ptr(client->if_none_match)->size--;
+    buf_push(client->accept_encoding, '\0');
+    buf_ptr(client->accept_encoding)->size--;
+
+    response_t* response = calloc(1, sizeof(response_t));
+    response->client = client;
+    response->keep_alive = http_should_keep_alive(parser);
+    response->timer.data = response;
+    response->write_req.data = response;
+    route(client, &response->data);
+
+    client->refs++;
+    uv_timer_init(uv_default_loop(), &response->timer);
+    u64 delay_ms = config.cfg_latency_ms;
+    if (config.cfg_slow_every && requests_count % config.cfg_slow_every == 0)
+        delay_ms += config.cfg_slow_ms;
+    uv_timer_start(&response->timer, on_response_delay, delay_ms, 0);
+    return 0;
+}
+
+static const http_parser_settings parser_settings = {
+    .on_message_begin = on_message_begin,
+    .on_url = on_url,
+    .on_header_field = on_header_field,
+    .on_header_value = on_header_value,
+    .on_message_complete = on_message_complete,
+};
+
+static void alloc_cb(uv_handle_t* handle, size_t suggested_size,
+                     uv_buf_t* buf) {
+    (void)handle;
+    buf->base = malloc(suggested_size);
+    buf->len = suggested_size;
+}
+
+static void on_read(uv_stream_t* stream, ssize_t nread, const uv_buf_t* buf) {
+    client_t* client = stream->data;
+
+    if (nread > 0) {
+        uv_timer_again(&client->timer);
+        const size_t parsed = http_parser_execute(
+            &client->parser, &parser_settings, buf->base, nread);
+        if (client->parser.upgrade || parsed != (size_t)nread) {
+            fprintf(stderr, "%s:%d:Error parsing request: %s\n", __FILE__,
+                    __LINE__, http_errno_name(client->parser.http_errno));
+            client_close(client);
+        }
+    } else if (nread < 0) {
+        if (nread != UV_EOF)
+            fprintf(stderr, "%s:%d:Error reading: %s\n", __FILE__, __LINE__,
+                    uv_strerror(nread));
+        client_close(client);
+    }
+
+    if (buf) free((void*)buf->base);
+}
+
+static void on_idle_timeout(uv_timer_t* timer) { client_close(timer->data); }
+
+static void on_connection(uv_stream_t* server, int status) {
+    if (status != 0) {
+        fprintf(stderr, "%s:%d:Error on_connection: %s\n", __FILE__, __LINE__,
+                uv_strerror(status));
+        return;
+    }
+
+    client_t* client = calloc(1, sizeof(client_t));
+    client->refs = 1;
+    uv_tcp_init(uv_default_loop(), &client->tcp);
+    uv_timer_init(uv_default_loop(), &client->timer);
+    client->tcp.data = client;
+    client->timer.data = client;
+    http_parser_init(&client->parser, HTTP_REQUEST);
+    client->parser.data = client;
+
+    if ((status = uv_accept(server, (uv_stream_t*)&client->tcp)) != 0) {
+        fprintf(stderr, "%s:%d:Error uv_accept: %s\n", __FILE__, __LINE__,
+                uv_strerror(status));
+        client_close(client);
+        return;
+    }
+    uv_tcp_nodelay(&client->tcp, 1);
+    uv_timer_start(&client->timer, on_idle_timeout, IDLE_TIMEOUT_MS,
+                   IDLE_TIMEOUT_MS);
+
+    if ((status = uv_read_start((uv_stream_t*)&client->tcp, alloc_cb,
+                                on_read)) != 0) {
+        fprintf(stderr, "%s:%d:Error uv_read_start: %s\n", __FILE__, __LINE__,
+                uv_strerror(status));
+        client_close(client);
+    }
+}
+
+int main() {
+    config = (config_t){
+        .cfg_projects = env_u64("MOCK_PROJECTS", 100),
+        .cfg_pipelines = env_u64("MOCK_PIPELINES", 100),
+        .cfg_per_page = env_u64("MOCK_PER_PAGE", 20),
+        .cfg_latency_ms = env_u64("MOCK_LATENCY_MS", 0),
+        .cfg_slow_every = env_u64("MOCK_SLOW_EVERY", 0),
+        .cfg_slow_ms = env_u64("MOCK_SLOW_MS", 2000),
+        .cfg_429_every = env_u64("MOCK_429_EVERY", 0),
+        .cfg_rate_limit = env_u64("MOCK_RATE_LIMIT", 0),
+        .cfg_gzip = env_u64("MOCK_GZIP", 1),
+    };
+    if (config.cfg_per_page == 0) config.cfg_per_page = 20;
+    const u16 port = (u16)env_u64("PORT", 8889);
+
+    struct sockaddr_in addr;
+    uv_ip4_addr("127.0.0.1", port, &addr);
+
+    uv_tcp_t server = {0};
+    int status = 0;
+    if ((status = uv_tcp_init(uv_default_loop(), &server)) != 0) {
+        fprintf(stderr, "%s:%d:Error uv_tcp_init: %s\n", __FILE__, __LINE__,
+                uv_strerror(status));
+        return status;
+    }
+    if ((status = uv_tcp_bind(&server, (const struct sockaddr*)&addr, 0)) !=
+        0) {
+        fprintf(stderr, "%s:%d:Error uv_tcp_bind: %s\n", __FILE__, __LINE__,
+                uv_strerror(status));
+        return status;
+    }
+    if ((status = uv_listen((uv_stream_t*)&server, 128, on_connection)) !=
+        0) {
+        fprintf(stderr, "%s:%d:Error uv_listen: %s\n", __FILE__, __LINE__,
+                uv_strerror(status));
+        return status;
+    }
+
+    fprintf(stderr,
+            "Listening: port=%hu projects=%llu pipelines=%llu per_page=%llu "
+            "latency_ms=%llu\n",
+            port, (unsigned long long)config.cfg_projects,
+            (unsigned long long)config.cfg_pipelines,
+            (unsigned long long)config.cfg_per_page,
+            (unsigned long long)config.cfg_latency_ms);
+    return uv_run(uv_default_loop(), UV_RUN_DEFAULT);
+}
@@ -0,0 +1,192 @@
+// Answer questions about the pipelines from a snapshot written by
+// `gitlab-api -o`, without touching the network or parsing anything: the
+// file is mapped and the columns are scanned in place.
+//
+//   snapshot-query FILE latest STATUS [REF]  Latest pipeline per project with
+//                                            that status (and ref)
+//   snapshot-query FILE counts [REF]         Pipelines per status
+//   snapshot-query FILE project ID           All pipelines of a project
+//
+// The time spent mapping the file and answering is printed on stderr.
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "common.h"
+#include "snapshot.h"
+
+static u64 now_ns() {
+    struct timespec ts = {0};
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (u64)ts.tv_sec * 1000000000 + (u64)ts.tv_nsec;
+}
+
+static void pipeline_print(const snapshot_header_t* h,
+                           const snapshot_project_t* project, u64 row) {
+    printf(
+        "[%lld] Pipeline: id=%lld ref=%s created_at=%lld updated_at=%lld "
+        "status=%s url=%s\n",
+        (long long)project->sp_id, (long long)snapshot_pipeline_ids(h)[row],
+        snapshot_str(h, snapshot_pipeline_refs(h)[row]),
+        (long long)snapshot_pipeline_created_at(h)[row],
+        (long long)snapshot_pipeline_updated_at(h)[row],
+        pipeline_status_str[snapshot_pipeline_statuses(h)[row] %
+                            PIP_STATUS_COUNT],
+        snapshot_str(h, snapshot_pipeline_urls(h)[row]));
+}
+
+// Resolve an optional ref to its string table offset. Returns false when the
+// ref is not in the snapshot at all, i.e. no pipeline can match.
+static bool ref_resolve(const snapshot_header_t* h, const char* ref,
+                        u32* ref_off) {
+    *ref_off = UINT32_MAX;
+    if (ref == NULL) return true;
+
+    *ref_off = snapshot_str_find(h, ref);
+    return *ref_off != UINT32_MAX;
+}
+
+static int query_latest(const snapshot_header_t* h, const char* status_str,
+                        const char* ref) {
+    const pipeline_status_t status =
+        pipeline_status_parse(status_str, strlen(status_str));
+    if (status == PIP_STATUS_UNKNOWN) {
+        fprintf(stderr, "%s:%d:Unknown status: %s\n", __FILE__, __LINE__,
+                status_str);
+        return 1;
+    }
+    u32 ref_off = 0;
+    if (!ref_resolve(h, ref, &ref_off)) return 0;
+
+    const snapshot_project_t* const projects = snapshot_projects(h);
+    const u8* const statuses = snapshot_pipeline_statuses(h);
+    const u32* const refs = snapshot_pipeline_refs(h);
+    for (u64 i = 0; i < h->sh_projects_len; i++) {
+        const snapshot_project_t* const project = &projects[i];
+        const u64 end = project->sp_pipelines_off + project->sp_pipelines_len;
+
+        // Rows are sorted by `updated_at` descending: the first match wins.
+        for (u64 row = project->sp_pipelines_off; row < end; row++) {
+            if (statuses[row] == status &&
+                (ref == NULL || refs[row] == ref_off)) {
+                pipeline_print(h, project, row);
+                break;
+            }
+        }
+    }
+    return 0;
+}
+
+static int query_counts(const snapshot_header_t* h, const char* ref) {
+    u32 ref_off = 0;
+    u64 counts[PIP_STATUS_COUNT] = {0};
+    if (ref_resolve(h, ref, &ref_off)) {
+        const u8* const statuses = snapshot_pipeline_statuses(h);
+        const u32* const refs = snapshot_pipeline_refs(h);
+        for (u64 row = 0; row < h->sh_pipelines_len; row++) {
+            if (ref == NULL || refs[row] == ref_off)
+                counts[statuses[row] % PIP_STATUS_COUNT]++;
+        }
+    }
+
+    for (u8 i = 0; i < PIP_STATUS_COUNT; i++) {
+        if (counts[i])
+            printf("%s=%llu\n", pipeline_status_str[i],
+                   (unsigned long long)counts[i]);
+    }
+    return 0;
+}
+
+static int query_project(const snapshot_header_t* h, i64 id) {
+    const snapshot_project_t* const projects = snapshot_projects(h);
+    for (u64 i = 0; i < h->sh_projects_len; i++) {
+        const snapshot_project_t* const project = &projects[i];
+        if (project->sp_id != id) continue;
+
+        printf("Project: id=%lld path_with_namespace=%s name=%s\n",
+               (long long)project->sp_id,
+               snapshot_str(h, project->sp_path_with_namespace),
+               snapshot_str(h, project->sp_name));
+        const u64 end = project->sp_pipelines_off + project->sp_pipelines_len;
+        for (u64 row = project->sp_pipelines_off; row < end; row++)
+            pipeline_print(h, project, row);
+        return 0;
+    }
+    fprintf(stderr, "%s:%d:Project not found: id=%lld\n", __FILE__, __LINE__,
+            (long long)id);
+    return 1;
+}
+
+static void usage(const char* name) {
+    fprintf(stderr,
+            "Usage: %s FILE latest STATUS [REF]\n"
+            "       %s FILE counts [REF]\n"
+            "       %s FILE project ID\n",
+            name, name, name);
+}
+
+int main(int argc, char* argv[]) {
+    if (argc < 3) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    const u64 start_ns = now_ns();
+    const int fd = open(argv[1], O_RDONLY);
+    if (fd == -1) {
+        fprintf(stderr, "%s:%d:Error opening snapshot: path=%s err=%s\n",
+                __FILE__, __LINE__, argv[1], strerror(errno));
+        return 1;
+    }
+    struct stat st = {0};
+    if (fstat(fd, &st) == -1 || st.st_size == 0) {
+        fprintf(stderr, "%s:%d:Error reading snapshot: path=%s err=%s\n",
+                __FILE__, __LINE__, argv[1],
+                st.st_size == 0 ? "empty file" : strerror(errno));
+        close(fd);
+        return 1;
+    }
+    void* const data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) {
+        fprintf(stderr, "%s:%d:Error mapping snapshot: path=%s err=%s\n",
+                __FILE__, __LINE__, argv[1], strerror(errno));
+        return 1;
+    }
+    const snapshot_header_t* const h = snapshot_open(data, st.st_size);
+    if (h == NULL) {
+        fprintf(stderr, "%s:%d:Invalid snapshot: path=%s\n", __FILE__,
+                __LINE__, argv[1]);
+        munmap(data, st.st_size);
+        return 1;
+    }
+    const u64 mapped_ns = now_ns();
+
+    int res = 1;
+    const char* const cmd = argv[2];
+    if (strcmp(cmd, "latest") == 0 && (argc == 4 || argc == 5))
+        res = query_latest(h, argv[3], argc == 5 ? argv[4] : NULL);
+    else if (strcmp(cmd, "counts") == 0 && (argc == 3 || argc == 4))
+        res = query_counts(h, argc == 4 ? argv[3] : NULL);
+    else if (strcmp(cmd, "project") == 0 && argc == 4)
+        res = query_project(h, strtoll(argv[3], NULL, 10));
+    else
+        usage(argv[0]);
+    const u64 end_ns = now_ns();
+
+    fprintf(stderr,
+            "Snapshot: projects=%llu pipelines=%llu created_at=%lld "
+            "open_us=%.1f query_us=%.1f\n",
+            (unsigned long long)h->sh_projects_len,
+            (unsigned long long)h->sh_pipelines_len,
+            (long long)h->sh_created_at, (mapped_ns - start_ns) / 1e3,
+            (end_ns - mapped_ns) / 1e3);
+    munmap(data, st.st_size);
+    return res;
+}
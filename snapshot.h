@@ -0,0 +1,200 @@
+#pragma once
+
+// On-disk snapshot of a poll of the GitLab pipelines, written by gitlab-api
+// and meant to be `mmap`ed as is by readers (snapshot-query, main.c): no
+// parsing, every section is a plain array at a fixed offset.
+//
+// Layout (all offsets from the start of the file, 8 bytes aligned, host
+// endianness):
+//
+//   snapshot_header_t
+//   snapshot_project_t[sh_projects_len]
+//   int64_t  pipeline ids[sh_pipelines_len]
+//   int64_t  pipeline created_at[sh_pipelines_len]   (epoch seconds)
+//   int64_t  pipeline updated_at[sh_pipelines_len]   (epoch seconds)
+//   uint32_t pipeline refs[sh_pipelines_len]         (string table offsets)
+//   uint32_t pipeline urls[sh_pipelines_len]         (string table offsets)
+//   uint8_t  pipeline statuses[sh_pipelines_len]     (pipeline_status_t)
+//   char     string table[sh_strings_size]           (NUL terminated strings)
+//
+// Pipelines are grouped by project and sorted by `updated_at`, most recent
+// first, inside each project: the project entry gives the row range.
+// Strings are deduplicated, so two refs are equal iff their offsets are.
+//
+// The file is written to a temporary path and renamed, so readers always see
+// a complete snapshot.
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#define SNAPSHOT_MAGIC "GLPIPES"  // 8 bytes with the NUL
+#define SNAPSHOT_VERSION 1
+
+typedef enum {
+    PIP_STATUS_UNKNOWN,
+    PIP_STATUS_CREATED,
+    PIP_STATUS_WAITING_FOR_RESOURCE,
+    PIP_STATUS_PREPARING,
+    PIP_STATUS_PENDING,
+    PIP_STATUS_RUNNING,
+    PIP_STATUS_SUCCESS,
+    PIP_STATUS_FAILED,
+    PIP_STATUS_CANCELED,
+    PIP_STATUS_SKIPPED,
+    PIP_STATUS_MANUAL,
+    PIP_STATUS_SCHEDULED,
+    PIP_STATUS_COUNT,
+} pipeline_status_t;
+
+static const char* const pipeline_status_str[PIP_STATUS_COUNT] = {
+    [PIP_STATUS_UNKNOWN] = "unknown",
+    [PIP_STATUS_CREATED] = "created",
+    [PIP_STATUS_WAITING_FOR_RESOURCE] = "waiting_for_resource",
+    [PIP_STATUS_PREPARING] = "preparing",
+    [PIP_STATUS_PENDING] = "pending",
+    [PIP_STATUS_RUNNING] = "running",
+    [PIP_STATUS_SUCCESS] = "success",
+    [PIP_STATUS_FAILED] = "failed",
+    [PIP_STATUS_CANCELED] = "canceled",
+    [PIP_STATUS_SKIPPED] = "skipped",
+    [PIP_STATUS_MANUAL] = "manual",
+    [PIP_STATUS_SCHEDULED] = "scheduled",
+};
+
+static inline pipeline_status_t pipeline_status_parse(const char* s,
+                                                      size_t len) {
+    for (uint8_t i = 1; i < PIP_STATUS_COUNT; i++) {
+        if (strlen(pipeline_status_str[i]) == len &&
+            memcmp(pipeline_status_str[i], s, len) == 0)
+            return (pipeline_status_t)i;
+    }
+    return PIP_STATUS_UNKNOWN;
+}
+
+typedef struct {
+    char sh_magic[8];
+    uint32_t sh_version;
+    uint32_t sh_header_size;
+    uint64_t sh_file_size;
+    int64_t sh_created_at;  // Epoch seconds
+    uint64_t sh_projects_len, sh_pipelines_len, sh_strings_size;
+
+    uint64_t sh_projects_off;
+    uint64_t sh_pipeline_ids_off, sh_pipeline_created_at_off,
+        sh_pipeline_updated_at_off, sh_pipeline_refs_off, sh_pipeline_urls_off,
+        sh_pipeline_statuses_off;
+    uint64_t sh_strings_off;
+} snapshot_header_t;
+
+typedef struct {
+    int64_t sp_id;
+    uint32_t sp_name, sp_path_with_namespace;  // String table offsets
+    uint64_t sp_pipelines_off, sp_pipelines_len;    // Pipeline rows
+} snapshot_project_t;
+
+#define SNAPSHOT_ALIGN(n) (((n) + 7) & ~(uint64_t)7)
+
+static inline int snapshot_section_ok(uint64_t off, uint64_t len,
+                                      uint64_t elem_size, uint64_t file_size) {
+    return off % 8 == 0 && off <= file_size &&
+           len <= (file_size - off) / elem_size;
+}
+
+// Return the header if `data` holds a well-formed snapshot, NULL otherwise.
+// The section bounds and the row range of every project are checked, in
+// O(projects), so that readers can index the rows of a project as is. The
+// rest of the content is not.
+static inline const snapshot_header_t* snapshot_open(const void* data,
+                                                     size_t size) {
+    const snapshot_header_t* const h = data;
+    if (size < sizeof(snapshot_header_t) ||
+        memcmp(h->sh_magic, SNAPSHOT_MAGIC, sizeof(h->sh_magic)) != 0 ||
+        h->sh_version != SNAPSHOT_VERSION ||
+        h->sh_header_size != sizeof(snapshot_header_t) ||
+        h->sh_file_size != size)
+        return NULL;
+
+    const uint64_t n = h->sh_pipelines_len;
+    if (!snapshot_section_ok(h->sh_projects_off, h->sh_projects_len,
+                             sizeof(snapshot_project_t), size) ||
+        !snapshot_section_ok(h->sh_pipeline_ids_off, n, 8, size) ||
+        !snapshot_section_ok(h->sh_pipeline_created_at_off, n, 8, size) ||
+        !snapshot_section_ok(h->sh_pipeline_updated_at_off, n, 8, size) ||
+        !snapshot_section_ok(h->sh_pipeline_refs_off, n, 4, size) ||
+        !snapshot_section_ok(h->sh_pipeline_urls_off, n, 4, size) ||
+        !snapshot_section_ok(h->sh_pipeline_statuses_off, n, 1, size) ||
+        !snapshot_section_ok(h->sh_strings_off, h->sh_strings_size, 1, size) ||
+        h->sh_strings_size == 0 ||
+        ((const char*)data)[h->sh_strings_off + h->sh_strings_size - 1] != 0)
+        return NULL;
+
+    const snapshot_project_t* const projects =
+        (const void*)((const char*)data + h->sh_projects_off);
+    for (uint64_t i = 0; i < h->sh_projects_len; i++) {
+        if (projects[i].sp_pipelines_off > n ||
+            projects[i].sp_pipelines_len > n - projects[i].sp_pipelines_off)
+            return NULL;
+    }
+
+    return h;
+}
+
+#define SNAPSHOT_SECTION(h, off) ((const void*)((const char*)(h) + (off)))
+
+static inline const snapshot_project_t* snapshot_projects(
+    const snapshot_header_t* h) {
+    return SNAPSHOT_SECTION(h, h->sh_projects_off);
+}
+
+static inline const int64_t* snapshot_pipeline_ids(
+    const snapshot_header_t* h) {
+    return SNAPSHOT_SECTION(h, h->sh_pipeline_ids_off);
+}
+
+static inline const int64_t* snapshot_pipeline_created_at(
+    const snapshot_header_t* h) {
+    return SNAPSHOT_SECTION(h, h->sh_pipeline_created_at_off);
+}
+
+static inline const int64_t* snapshot_pipeline_updated_at(
+    const snapshot_header_t* h) {
+    return SNAPSHOT_SECTION(h, h->sh_pipeline_updated_at_off);
+}
+
+static inline const uint32_t* snapshot_pipeline_refs(
+    const snapshot_header_t* h) {
+    return SNAPSHOT_SECTION(h, h->sh_pipeline_refs_off);
+}
+
+static inline const uint32_t* snapshot_pipeline_urls(
+    const snapshot_header_t* h) {
+    return SNAPSHOT_SECTION(h, h->sh_pipeline_urls_off);
+}
+
+static inline const uint8_t* snapshot_pipeline_statuses(
+    const snapshot_header_t* h) {
+    return SNAPSHOT_SECTION(h, h->sh_pipeline_statuses_off);
+}
+
+// Offsets past the end of the table map to the empty string at offset 0.
+static inline const char* snapshot_str(const snapshot_header_t* h,
+                                       uint32_t off) {
+    const char* const strings = SNAPSHOT_SECTION(h, h->sh_strings_off);
+    return off < h->sh_strings_size ? strings + off : strings;
+}
+
+// Offset of `s` in the string table or UINT32_MAX if absent. Linear in the
+// size of the table: do it once per query, then compare offsets.
+static inline uint32_t snapshot_str_find(const snapshot_header_t* h,
+                                         const char* s) {
+    const char* const strings = SNAPSHOT_SECTION(h, h->sh_strings_off);
+    const size_t len = strlen(s);
+    for (uint64_t off = 0; off < h->sh_strings_size;) {
+        const size_t cur_len = strlen(strings + off);
+        if (cur_len == len && memcmp(strings + off, s, len) == 0)
+            return (uint32_t)off;
+        off += cur_len + 1;
+    }
+    return UINT32_MAX;
+}
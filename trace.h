@@ -0,0 +1,236 @@
+#pragma once
+
+// Low overhead tracing: fixed size binary events recorded into per-thread
+// ring buffers and dumped in the Chrome trace event format (open the file in
+// chrome://tracing or https://ui.perfetto.dev).
+//
+// Tracing is decided at runtime:
+//   - TRACE_FILE=path in the environment turns it on from the start and sets
+//     where the dumps go (default: trace.json)
+//   - SIGUSR2 toggles it, SIGUSR1 dumps the rings (see `trace_signals_start`)
+//   - `trace_dump` dumps on demand, e.g. at exit
+//
+// Disabled, a TRACE_* macro is a relaxed load and a predicted branch.
+// Enabled, it is a clock read and a 32 bytes store into the ring of the
+// calling thread: no lock, no allocation after the first event of a thread,
+// no system call. A ring keeps the last TRACE_RING_LEN events of its thread.
+//
+// Events ids are an enum of the program, described by the `trace_desc_t`
+// table given to `trace_init`. Each event has two integer arguments:
+//   - TRACE_BEGIN/TRACE_END: a span on one thread, e.g. parsing a response
+//   - TRACE_ASYNC_BEGIN/TRACE_ASYNC_END: a span matched by its first
+//     argument, e.g. a transfer started and finished in different callbacks
+//   - TRACE_INSTANT: a point in time
+// End events only have a result, their second argument.
+
+#include <errno.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+#include <uv.h>
+
+#define TRACE_RING_LEN 8192  // Events per thread, a power of two
+
+typedef struct {
+    const char* td_name;
+    const char* td_args[2];  // Names of the arguments, NULL if unused
+} trace_desc_t;
+
+typedef struct {
+    uint64_t te_ts_ns;  // CLOCK_MONOTONIC
+    uint16_t te_id;
+    char te_phase;  // Chrome trace phase: 'B', 'E', 'b', 'e' or 'i'
+    uint64_t te_args[2];
+} trace_event_t;
+
+typedef struct trace_ring_t {
+    struct trace_ring_t* tr_next;  // All the rings, newest first
+    uint64_t tr_tid;
+    uint64_t tr_len;  // Events ever written, only the owner thread writes
+    trace_event_t tr_events[TRACE_RING_LEN];
+} trace_ring_t;
+
+static struct {
+    int tc_enabled;
+    const char* tc_path;
+    const trace_desc_t* tc_descs;
+    uint16_t tc_descs_len;
+    trace_ring_t* tc_rings;
+    uv_signal_t tc_sigusr1, tc_sigusr2;
+} trace_ctx;
+
+static __thread trace_ring_t* trace_ring;
+
+static inline void trace_init(const trace_desc_t* descs, uint16_t descs_len) {
+    trace_ctx.tc_descs = descs;
+    trace_ctx.tc_descs_len = descs_len;
+    trace_ctx.tc_path = getenv("TRACE_FILE");
+    if (trace_ctx.tc_path != NULL && trace_ctx.tc_path[0] != '\0')
+        __atomic_store_n(&trace_ctx.tc_enabled, 1, __ATOMIC_RELAXED);
+    else
+        trace_ctx.tc_path = "trace.json";
+}
+
+static inline void trace_set_enabled(bool enabled) {
+    __atomic_store_n(&trace_ctx.tc_enabled, enabled, __ATOMIC_RELAXED);
+}
+
+static inline trace_ring_t* trace_ring_new(void) {
+    trace_ring_t* const ring = calloc(1, sizeof(trace_ring_t));
+    if (ring == NULL) return NULL;
+    ring->tr_tid = (uint64_t)syscall(SYS_gettid);
+
+    ring->tr_next = __atomic_load_n(&trace_ctx.tc_rings, __ATOMIC_RELAXED);
+    while (!__atomic_compare_exchange_n(&trace_ctx.tc_rings, &ring->tr_next,
+                                        ring, true, __ATOMIC_RELEASE,
+                                        __ATOMIC_RELAXED))
+        ;
+    return trace_ring = ring;
+}
+
+static inline void trace_emit(uint16_t id, char phase, uint64_t arg0,
+                              uint64_t arg1) {
+    trace_ring_t* const ring = trace_ring ? trace_ring : trace_ring_new();
+    if (ring == NULL) return;
+
+    struct timespec ts = {0};
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    const uint64_t len = ring->tr_len;
+    trace_event_t* const event = &ring->tr_events[len & (TRACE_RING_LEN - 1)];
+    event->te_ts_ns = (uint64_t)ts.tv_sec * 1000000000 + (uint64_t)ts.tv_nsec;
+    event->te_id = id;
+    event->te_phase = phase;
+    event->te_args[0] = arg0;
+    event->te_args[1] = arg1;
+    __atomic_store_n(&ring->tr_len, len + 1, __ATOMIC_RELEASE);
+}
+
+#define TRACE_EVENT(id, phase, arg0, arg1)                                  \
+    do {                                                                    \
+        if (__builtin_expect(                                               \
+                __atomic_load_n(&trace_ctx.tc_enabled, __ATOMIC_RELAXED), \
+                0))                                                         \
+            trace_emit((id), (phase), (uint64_t)(arg0), (uint64_t)(arg1));  \
+    } while (0)
+
+#define TRACE_BEGIN(id, arg0, arg1) TRACE_EVENT(id, 'B', arg0, arg1)
+#define TRACE_END(id, result) TRACE_EVENT(id, 'E', 0, result)
+#define TRACE_ASYNC_BEGIN(id, key, arg1) TRACE_EVENT(id, 'b', key, arg1)
+#define TRACE_ASYNC_END(id, key, result) TRACE_EVENT(id, 'e', key, result)
+#define TRACE_INSTANT(id, arg0, arg1) TRACE_EVENT(id, 'i', arg0, arg1)
+
+static inline void trace_event_write(FILE* f, uint64_t tid,
+                                     const trace_event_t* event, bool first) {
+    const trace_desc_t* const desc = event->te_id < trace_ctx.tc_descs_len
+                                         ? &trace_ctx.tc_descs[event->te_id]
+                                         : NULL;
+    fprintf(f, "%s{\"name\":\"%s\",\"ph\":\"%c\",\"ts\":%.3f,\"pid\":%d,"
+            "\"tid\":%llu",
+            first ? "" : ",\n", desc ? desc->td_name : "unknown",
+            event->te_phase, event->te_ts_ns / 1e3, (int)getpid(),
+            (unsigned long long)tid);
+
+    const bool is_async = event->te_phase == 'b' || event->te_phase == 'e';
+    const bool is_end = event->te_phase == 'E' || event->te_phase == 'e';
+    if (is_async)
+        fprintf(f, ",\"cat\":\"async\",\"id\":\"0x%llx\"",
+                (unsigned long long)event->te_args[0]);
+    if (event->te_phase == 'i') fputs(",\"s\":\"t\"", f);
+
+    fputs(",\"args\":{", f);
+    if (is_end) {
+        fprintf(f, "\"result\":%llu", (unsigned long long)event->te_args[1]);
+    } else if (desc) {
+        bool sep = false;
+        for (int i = is_async ? 1 : 0; i < 2; i++) {
+            if (desc->td_args[i] == NULL) continue;
+            fprintf(f, "%s\"%s\":%llu", sep ? "," : "", desc->td_args[i],
+                    (unsigned long long)event->te_args[i]);
+            sep = true;
+        }
+    }
+    fputs("}}", f);
+}
+
+// Write every ring to `tc_path`, the threads keep recording meanwhile. The
+// file is replaced atomically so a viewer never loads half a dump.
+static inline int trace_dump(void) {
+    char tmp_path[4096] = "";
+    snprintf(tmp_path, sizeof(tmp_path), "%s.tmp.%d", trace_ctx.tc_path,
+             (int)getpid());
+    FILE* const f = fopen(tmp_path, "w");
+    if (f == NULL) {
+        fprintf(stderr, "%s:%d:Error opening trace file: path=%s err=%s\n",
+                __FILE__, __LINE__, tmp_path, strerror(errno));
+        return -1;
+    }
+    trace_event_t* const events =
+        malloc(sizeof(trace_event_t) * TRACE_RING_LEN);
+    if (events == NULL) abort();
+
+    uint64_t count = 0;
+    fputs("{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n", f);
+    for (trace_ring_t* ring =
+             __atomic_load_n(&trace_ctx.tc_rings, __ATOMIC_ACQUIRE);
+         ring != NULL; ring = ring->tr_next) {
+        const uint64_t end = __atomic_load_n(&ring->tr_len, __ATOMIC_ACQUIRE);
+        const uint64_t start = end > TRACE_RING_LEN ? end - TRACE_RING_LEN : 0;
+        for (uint64_t i = start; i < end; i++)
+            events[i - start] = ring->tr_events[i & (TRACE_RING_LEN - 1)];
+
+        // Drop what the owner overwrote while we were copying.
+        const uint64_t now_len =
+            __atomic_load_n(&ring->tr_len, __ATOMIC_ACQUIRE);
+        const uint64_t valid_from =
+            now_len > TRACE_RING_LEN ? now_len - TRACE_RING_LEN + 1 : 0;
+        for (uint64_t i = start > valid_from ? start : valid_from; i < end;
+             i++)
+            trace_event_write(f, ring->tr_tid, &events[i - start],
+                              count++ == 0);
+    }
+    fputs("\n]}\n", f);
+    free(events);
+
+    if (fclose(f) != 0 || rename(tmp_path, trace_ctx.tc_path) == -1) {
+        fprintf(stderr, "%s:%d:Error writing trace file: path=%s err=%s\n",
+                __FILE__, __LINE__, trace_ctx.tc_path, strerror(errno));
+        unlink(tmp_path);
+        return -1;
+    }
+    fprintf(stderr, "Trace: path=%s events=%llu\n", trace_ctx.tc_path,
+            (unsigned long long)count);
+    return 0;
+}
+
+static inline void trace_on_signal(uv_signal_t* signal, int signum) {
+    (void)signal;
+    if (signum == SIGUSR1) {
+        trace_dump();
+    } else {
+        const bool enabled =
+            !__atomic_load_n(&trace_ctx.tc_enabled, __ATOMIC_RELAXED);
+        trace_set_enabled(enabled);
+        fprintf(stderr, "Trace: enabled=%d\n", enabled);
+    }
+}
+
+// The handles do not keep the loop alive.
+static inline void trace_signals_start(uv_loop_t* loop) {
+    uv_signal_init(loop, &trace_ctx.tc_sigusr1);
+    uv_signal_init(loop, &trace_ctx.tc_sigusr2);
+    uv_signal_start(&trace_ctx.tc_sigusr1, trace_on_signal, SIGUSR1);
+    uv_signal_start(&trace_ctx.tc_sigusr2, trace_on_signal, SIGUSR2);
+    uv_unref((uv_handle_t*)&trace_ctx.tc_sigusr1);
+    uv_unref((uv_handle_t*)&trace_ctx.tc_sigusr2);
+}
+
+static inline void trace_signals_stop(void) {
+    uv_close((uv_handle_t*)&trace_ctx.tc_sigusr1, NULL);
+    uv_close((uv_handle_t*)&trace_ctx.tc_sigusr2, NULL);
+}